@@ -7,12 +7,18 @@
 #include "../evie/profiler.hpp"
 #include "../makoa/types.hpp"
 #include "../evie/string.hpp"
+#include "../evie/mlog.hpp"
+
+#include <stdlib.h>
 
 u32 emessages::proceed_instr(str_holder exchange_id, str_holder feed_id, str_holder ticker, ttime_t time)
 {
     if(m_s == pre_alloc) [[unlikely]]
         send_messages();
 
+    if(exchange.empty())
+        exchange = exchange_id;
+
     message_instr& mi = ms[m_s++].mi;
 
     mi.time = time;
@@ -39,8 +45,14 @@ u32 emessages::proceed_instr(str_holder exchange_id, str_holder feed_id, str_hol
     return mi.security_id;
 }
 
-emessages::emessages(const mstring& push) : e(push), m_s()
+emessages::emessages(const mstring& push) : e(push), m_s(), trace_rate(), trace_count(), trace_id()
 {
+    char_cit r = getenv("trace_rate");
+    if(r)
+    {
+        trace_rate = lexical_cast<u32>(_str_holder(r));
+        mlog() << "emessages, trace_rate: " << trace_rate;
+    }
 }
 
 void emessages::ping(ttime_t etime, ttime_t time)
@@ -82,6 +94,7 @@ void emessages::add_order(u32 security_id, i64 level_id, price_t price, count_t
     m.level_id = level_id;
     m.price = price;
     m.count = count;
+    set_trace_id(m, next_trace());
 }
 
 void emessages::add_trade(u32 security_id, price_t price, count_t count, u32 direction,
@@ -98,6 +111,7 @@ void emessages::add_trade(u32 security_id, price_t price, count_t count, u32 dir
     m.security_id = security_id;
     m.price = price;
     m.count = count;
+    set_trace_id(m, next_trace());
 }
 
 void emessages::send_messages()
@@ -106,6 +120,10 @@ void emessages::send_messages()
     {
         e.proceed(ms, m_s);
         MPROFILE_COUNT("emessages::m_s", {m_s})
+        if(!messages.value) [[unlikely]]
+            messages = metric("alco_messages_total{exchange=\"" + metric_label(exchange.str()) + "\"}",
+                metrics::counter, "messages sent by parser");
+        messages.add(m_s);
         m_s = 0;
     }
 }
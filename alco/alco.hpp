@@ -5,6 +5,9 @@
 #pragma once
 
 #include "../makoa/exports.hpp"
+#include "../makoa/trace.hpp"
+
+#include "../evie/metrics.hpp"
 
 struct emessages
 {
@@ -12,6 +15,20 @@ struct emessages
     static const u32 pre_alloc = 150;
     message ms[pre_alloc];
     u32 m_s;
+    mstring exchange;
+    metric messages;
+    u32 trace_rate, trace_count, trace_id;
+
+    u32 next_trace()
+    {
+        if(!trace_rate || ++trace_count != trace_rate) [[likely]]
+            return 0;
+        trace_count = 0;
+        trace_id = (trace_id + 1) & trace_id_mask;
+        if(!trace_id)
+            trace_id = 1;
+        return trace_id;
+    }
 
     emessages(const mstring& push);
     emessages(const emessages&) = delete;
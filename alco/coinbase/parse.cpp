@@ -34,7 +34,7 @@ struct lws_i : sec_id_by_name<lws_impl>, read_time_impl
             throw_exception("coinbase, parsing error: ", str_holder(in, len));
         };
 
-        ttime_t time = cur_ttime();
+        ttime_t time = fast_ttime();
         if(cfg.log_lws)
             mlog() << "coinbase, lws proceed: " << str_holder(in, len);
         char_cit it = in, ie = it + len;
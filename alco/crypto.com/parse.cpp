@@ -44,7 +44,7 @@ struct lws_i: sec_id_by_name<lws_impl>
 
     void proceed(lws* wsi, char_cit in, size_t len)
     {
-        ttime_t time = cur_ttime();
+        ttime_t time = fast_ttime();
         if(cfg.log_lws)
             mlog() << "crypcom, lws proceed: " << str_holder(in, len);
         char_cit it = in, ie = it + len;
@@ -207,7 +207,7 @@ struct lws_i : sec_id_by_name<lws_impl>
     }
     void proceed(lws* wsi, char_cit in, size_t len)
     {
-        ttime_t time = cur_ttime();
+        ttime_t time = fast_ttime();
         str_holder str = zlib.decompress(in, len);
         if(cfg.log_lws)
             mlog() << "huobi, lws proceed: " << str;
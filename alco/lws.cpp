@@ -95,7 +95,7 @@ lws_dump::~lws_dump()
 
 lws_impl::lws_impl(const mstring& push, bool log_lws, char msg_beg, char msg_end, bool check_full) :
     emessages(push), log_lws(log_lws), bs(buf, buf + sizeof(buf) - 1),
-    closed(), data_time(cur_ttime_seconds()), msg_beg(msg_beg), msg_end(msg_end), check_full(check_full)
+    closed(), data_time(cur_ttime_seconds()), big_balance(), msg_beg(msg_beg), msg_end(msg_end), check_full(check_full)
 {
     bs.resize(LWS_PRE);
 }
@@ -158,8 +158,9 @@ int lws_event_cb(lws* wsi, enum lws_callback_reasons reason, void* user,
                 size_t sz = w->big_message.size();
                 w->big_message.resize(sz + len);
                 memcpy(w->big_message.begin() + sz, p, len);
+                w->big_balance += bytes_balance(p, p + len, w->msg_beg, w->msg_end);
 
-                if(w->full(w->big_message.begin(), w->big_message.end()))
+                if(!w->big_balance && p[len - 1] == w->msg_end)
                 {
                     if(w->lws_dump_en) [[unlikely]]
                         w->dump(w->big_message.begin(), w->big_message.size());
@@ -167,6 +168,7 @@ int lws_event_cb(lws* wsi, enum lws_callback_reasons reason, void* user,
                     MPROFILE("lws_event big_message_end")
                     w->proceed(wsi, w->big_message.begin(), w->big_message.size());
                     w->big_message.clear();
+                    w->big_balance = 0;
                 }
             }
             else
@@ -181,7 +183,7 @@ int lws_event_cb(lws* wsi, enum lws_callback_reasons reason, void* user,
                     w->dump((char_cit)in, len);
 
                 if(w->log_lws) [[unlikely]]
-                    mlog() << "lws receive len: " << len;
+                    BLOG("lws receive len: {}", len)
 
                 MPROFILE("lws_event proceed")
                 w->proceed(wsi, p, len);
@@ -223,7 +225,7 @@ int lws_event_cb(lws* wsi, enum lws_callback_reasons reason, void* user,
         default:
         {
             if(user && ((lws_impl*)user)->log_lws) [[unlikely]]
-                mlog() << "lws callback: " << int(reason) << ", len: " << len;
+                BLOG("lws callback: {}, len: {}", int(reason), len)
             break;
         }
     }
@@ -9,6 +9,8 @@
 #include "../evie/profiler.hpp"
 #include "../evie/string.hpp"
 #include "../evie/mlog.hpp"
+#include "../evie/blog.hpp"
+#include "../evie/json.hpp"
 
 #include <unistd.h>
 
@@ -39,6 +41,7 @@ struct lws_impl : emessages, lws_dump
     mvector<mstring> subscribes;
     lws_context* context;
     mvector<char> big_message;
+    i64 big_balance;
     const char msg_beg, msg_end;
     const bool check_full;
 
@@ -46,18 +49,7 @@ struct lws_impl : emessages, lws_dump
     {
         ASSERT(t > f);
 
-        if(*(t - 1) != msg_end)
-            return false;
-
-        u32 _f = 0, _t = 0;
-        for(; f != t; ++f)
-        {
-            if(*f == msg_beg)
-                ++_f;
-            else if(*f == msg_end)
-                ++_t;
-        }
-        return _f == _t;
+        return *(t - 1) == msg_end && !bytes_balance(f, t, msg_beg, msg_end);
     }
 
     lws_impl(const mstring& push, bool log_lws, char msg_beg = '{', char msg_end = '}',
@@ -99,9 +91,11 @@ void proceed_lws_parser(volatile bool& can_run)
 
     else while(can_run)
     {
+        mstring exchange;
         try
         {
             lws_w ls;
+            exchange = ls.cfg.exchange_id;
             ls.context = create_context();
             connect(ls);
 
@@ -120,6 +114,8 @@ void proceed_lws_parser(volatile bool& can_run)
         catch(exception& e)
         {
             mlog() << "proceed_lws_parser " << e;
+            metric("alco_reconnects_total{exchange=\"" + metric_label(exchange.str()) + "\"}",
+                metrics::counter, "parser reconnects after errors").add();
 
             if(getenv("lws_dump"))
                 throw;
@@ -29,7 +29,7 @@ struct parser : emessages, stack_singleton<parser>
     ttime_t ptime;
     void set_msg_begin()
     {
-        ptime = cur_ttime();
+        ptime = fast_ttime();
     }
     void set_msg_commit()
     {
@@ -92,7 +92,7 @@ struct parser : emessages, stack_singleton<parser>
     }
     void clear_order_book()
     {
-        ttime_t time = cur_ttime();
+        ttime_t time = fast_ttime();
         for(auto& v: tickers)
             add_clean(v.second, ttime_t(), time);
         send_messages();
@@ -0,0 +1,310 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+*/
+
+#include "blog.hpp"
+#include "algorithm.hpp"
+#include "atomic.hpp"
+#include "string.hpp"
+#include "utils.hpp"
+#include "thread.hpp"
+
+binary_log* blog_ptr;
+
+namespace
+{
+    u64 instances;
+    thread_local u64 ring_owner;
+    thread_local void* ring_ptr;
+
+    //drops thread reference of ring at thread exit
+    struct ring_exit
+    {
+        void* ring;
+        void (*release)(void*);
+
+        ~ring_exit()
+        {
+            ring_owner = 0;
+            if(ring)
+                release(ring);
+        }
+    };
+    thread_local ring_exit ring_holder;
+
+    template<typename type>
+    type get(char_cit& it)
+    {
+        type ret;
+        memcpy(&ret, it, sizeof(type));
+        it += sizeof(type);
+        return ret;
+    }
+
+    void write_decimal(buf_stream& s, i8 exponent, i64 value)
+    {
+        if(exponent >= 0)
+        {
+            s << value;
+            return;
+        }
+        i64 f = __pow10[-exponent], int_ = value / f, float_ = value % f;
+        if(value < 0)
+        {
+            s << '-';
+            int_ = -int_;
+            float_ = -float_;
+        }
+        char buf[24];
+        u32 sz = itoa(buf, float_);
+        s << int_ << '.';
+        for(u32 i = sz; i < u32(-exponent); ++i)
+            s << '0';
+        s.write(buf, sz);
+    }
+}
+
+binary_log::binary_log() : formats(), count(), rings(), freed_dropped(), uid(atomic_add(instances, u64(1)))
+{
+}
+
+binary_log::~binary_log()
+{
+    for(u32 i = 1; i <= count; ++i)
+        free((char_it)formats[i]);
+    ring* r = rings;
+    while(r)
+    {
+        ring* n = r->next;
+        release(r);
+        r = n;
+    }
+}
+
+void binary_log::release(void* p)
+{
+    ring* r = (ring*)p;
+    if(!atomic_sub(r->refs, 1u, __ATOMIC_ACQ_REL))
+        delete r;
+}
+
+u32 binary_log::register_format(char_cit format)
+{
+    char_it f = strndup(format, max_format_size);
+
+    for(;;)
+    {
+        u32 c = atomic_load(count) + 1;
+
+        if(c > max_formats)
+        {
+            free(f);
+            throw_exception("binary_log::register_format, overloaded");
+        }
+
+        if(atomic_compare_exchange<char_cit>(formats[c], nullptr, f))
+        {
+            atomic_add(count, 1u);
+            return c;
+        }
+    }
+}
+
+binary_log::ring& binary_log::local_ring()
+{
+    if(ring_owner != uid) [[unlikely]]
+    {
+        if(ring_holder.ring)
+            ring_holder.release(ring_holder.ring);
+        ring* r = new ring;
+        r->head = r->tail = r->dropped = r->merged = 0;
+        r->tid = get_thread_id();
+        r->refs = 2;
+        do
+            r->next = atomic_load(rings);
+        while(!atomic_compare_exchange(rings, r->next, r, __ATOMIC_RELEASE));
+        ring_holder = {r, &binary_log::release};
+        ring_ptr = r;
+        ring_owner = uid;
+    }
+    return *(ring*)ring_ptr;
+}
+
+char_it binary_log::reserve(ring& r, u32 size)
+{
+    u64 h = r.head, pos = h % ring_size, pad = 0;
+    if(pos + size > ring_size)
+        pad = ring_size - pos;
+    if(size > max_record
+        || h + pad + size - atomic_load(r.tail, __ATOMIC_ACQUIRE) > ring_size) [[unlikely]]
+    {
+        atomic_add(r.dropped, u64(1));
+        return nullptr;
+    }
+    if(pad)
+    {
+        record* p = (record*)(r.buf + pos);
+        p->size = pad;
+        p->format = 0;
+        atomic_store(r.head, h + pad, __ATOMIC_RELEASE);
+        pos = 0;
+    }
+    return r.buf + pos;
+}
+
+void binary_log::commit(ring& r, u32 size)
+{
+    atomic_store(r.head, r.head + size, __ATOMIC_RELEASE);
+}
+
+void binary_log::format(buf_stream& s, const record& r) const
+{
+    char_cit it = (char_cit)(&r + 1), ie = (char_cit)&r + r.size;
+    auto arg = [&]()
+    {
+        if(it == ie || *it == char(0xff))
+            return false;
+        tag t = tag(*it++);
+        if(t == t_i64)
+            s << get<i64>(it);
+        else if(t == t_u64)
+            s << get<u64>(it);
+        else if(t == t_double)
+            s << get<double>(it);
+        else if(t == t_char)
+            s << get<char>(it);
+        else if(t == t_bool)
+            s << get<bool>(it);
+        else if(t == t_str)
+        {
+            u16 sz = get<u16>(it);
+            s.write(it, sz);
+            it += sz;
+        }
+        else if(t == t_time)
+            s << ttime_t{get<i64>(it)};
+        else if(t == t_decimal)
+        {
+            i8 e = get<i8>(it);
+            write_decimal(s, e, get<i64>(it));
+        }
+        else
+            throw_exception("binary_log::format, bad tag");
+        return true;
+    };
+
+    char_cit f = atomic_load(formats[r.format], __ATOMIC_ACQUIRE);
+    for(char_cit n = f; *n; ++n)
+    {
+        if(n[0] == '{' && n[1] == '}')
+        {
+            s.write(f, n - f);
+            f = ++n + 1;
+            if(!arg())
+                s << "{}";
+        }
+    }
+    s << _str_holder(f);
+    while(it != ie && *it != char(0xff))
+    {
+        s << ' ';
+        arg();
+    }
+}
+
+//producers only push to list head
+void binary_log::unlink(ring* prev, ring* r)
+{
+    if(!prev)
+    {
+        for(;;)
+        {
+            if(atomic_compare_exchange(rings, r, r->next))
+                return;
+            prev = atomic_load(rings, __ATOMIC_ACQUIRE);
+            if(prev != r)
+                break;
+        }
+        while(prev->next != r)
+            prev = prev->next;
+    }
+    prev->next = r->next;
+}
+
+void binary_log::push_front(ring* r)
+{
+    for(u64 t = r->tail; t != r->merged;)
+    {
+        const record* p = (const record*)(r->buf + t % ring_size);
+        if(p->format)
+        {
+            front_t f{p, r};
+            fronts.insert(upper_bound(fronts.begin(), fronts.end(), f,
+                [](const front_t& a, const front_t& b) {return b.rec->time < a.rec->time;}), f);
+            return;
+        }
+        t += p->size;
+        atomic_store(r->tail, t, __ATOMIC_RELEASE);
+    }
+}
+
+void binary_log::merge()
+{
+    fronts.clear();
+    ring* prev = nullptr;
+    for(ring* r = atomic_load(rings, __ATOMIC_ACQUIRE); r;)
+    {
+        ring* next = r->next;
+        bool exited = atomic_load(r->refs, __ATOMIC_ACQUIRE) == 1;
+        r->merged = atomic_load(r->head, __ATOMIC_ACQUIRE);
+        if(exited && r->tail == r->merged)
+        {
+            unlink(prev, r);
+            freed_dropped += r->dropped;
+            delete r;
+        }
+        else
+        {
+            push_front(r);
+            prev = r;
+        }
+        r = next;
+    }
+}
+
+bool binary_log::front(ttime_t& time)
+{
+    if(fronts.empty())
+        return false;
+    time = fronts.back().rec->time;
+    return true;
+}
+
+bool binary_log::read(buf_stream& s, ttime_t& time, u32& tid)
+{
+    if(fronts.empty())
+        return false;
+    front_t f = fronts.back();
+    fronts.pop_back();
+    time = f.rec->time;
+    tid = f.r->tid;
+    format(s, *f.rec);
+    atomic_store(f.r->tail, f.r->tail + f.rec->size, __ATOMIC_RELEASE);
+    push_front(f.r);
+    return true;
+}
+
+u64 binary_log::dropped()
+{
+    u64 ret = freed_dropped;
+    freed_dropped = 0;
+    for(ring* r = atomic_load(rings, __ATOMIC_ACQUIRE); r; r = r->next)
+        ret += atomic_exchange(&r->dropped, u64(0));
+    return ret;
+}
+
+void binary_log::set_instance(binary_log* b)
+{
+    blog_ptr = b;
+}
+
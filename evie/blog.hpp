@@ -0,0 +1,182 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    binary log, BLOG(format, args...) copies registered format id and raw argument
+    bytes to per thread ring without formatting, mlog writer thread replaces every {}
+    in format by next argument and writes result as ordinary mlog row,
+    supported arguments: integrals, double, char, bool, decimals, ttime_t,
+    str_holder, char arrays and c strings (both cut to max_str),
+    record is dropped and counted when thread ring is full or record exceeds max_record,
+    rings of exited threads freed by reader after drain
+*/
+
+#pragma once
+
+#include "profiler.hpp"
+#include "mtime.hpp"
+#include "decimal.hpp"
+#include "str_holder.hpp"
+#include "type_traits.hpp"
+#include "vector.hpp"
+
+#define BLOG(format, ...) { static const u32 CLINE(blog_id) = \
+    blog_ptr->register_format(format); \
+    blog_ptr->write(CLINE(blog_id) __VA_OPT__(,) __VA_ARGS__); }
+
+struct buf_stream;
+
+class binary_log
+{
+public:
+    enum tag : u8
+    {
+        t_i64, t_u64, t_double, t_char, t_bool, t_str, t_time, t_decimal
+    };
+
+    static const u32 max_formats = 4096, max_format_size = 1024, max_str = 1024,
+        max_record = 4096, ring_size = 1024 * 1024;
+
+private:
+    struct record
+    {
+        u32 size, format; //format 0 for padding till ring end
+        ttime_t time;
+    };
+
+    struct ring
+    {
+        char buf[ring_size];
+        u64 head, tail, dropped, merged; //merged: head of last merge()
+        u32 tid, refs; //refs: writer thread and binary_log
+        ring* next;
+    };
+
+    struct front_t
+    {
+        const record* rec;
+        ring* r;
+    };
+
+    char_cit formats[max_formats + 1];
+    u32 count;
+    ring* rings;
+    mvector<front_t> fronts; //oldest records of rings, sorted by time descending
+    u64 freed_dropped; //dropped records of freed rings
+
+    const u64 uid;
+
+    ring& local_ring();
+    static void release(void* r);
+    void push_front(ring* r);
+    void unlink(ring* prev, ring* r);
+    char_it reserve(ring& r, u32 size);
+    void format(buf_stream& s, const record& r) const;
+
+    template<typename type>
+    static u32 arg_size(const type& v)
+    {
+        if constexpr(is_array_v<type>)
+            return 3 + strnlen(v, min<u64>(sizeof(v), max_str));
+        else if constexpr(is_same_v<type, char_cit> || is_same_v<type, char_it>)
+            return 3 + strnlen(v, max_str);
+        else if constexpr(is_same_v<type, str_holder>)
+            return 3 + min<u64>(v.size(), max_str);
+        else if constexpr(is_same_v<type, char> || is_same_v<type, bool>)
+            return 2;
+        else if constexpr(is_decimal<type> && !is_same_v<type, ttime_t>)
+            return 10;
+        else
+            return 9;
+    }
+    static char_it put(char_it p, tag t, const void* v, u32 size)
+    {
+        *p = t;
+        memcpy(p + 1, v, size);
+        return p + 1 + size;
+    }
+    static char_it put_str(char_it p, char_cit v, u16 size)
+    {
+        *p = t_str;
+        memcpy(p + 1, &size, 2);
+        memcpy(p + 3, v, size);
+        return p + 3 + size;
+    }
+    template<typename type>
+    static char_it put(char_it p, const type& v)
+    {
+        if constexpr(is_array_v<type>)
+            return put_str(p, v, strnlen(v, min<u64>(sizeof(v), max_str)));
+        else if constexpr(is_same_v<type, char_cit> || is_same_v<type, char_it>)
+            return put_str(p, v, strnlen(v, max_str));
+        else if constexpr(is_same_v<type, str_holder>)
+            return put_str(p, v.begin(), min<u64>(v.size(), max_str));
+        else if constexpr(is_same_v<type, char>)
+            return put(p, t_char, &v, 1);
+        else if constexpr(is_same_v<type, bool>)
+            return put(p, t_bool, &v, 1);
+        else if constexpr(is_same_v<type, ttime_t>)
+            return put(p, t_time, &v.value, 8);
+        else if constexpr(is_decimal<type>)
+        {
+            i8 e = type::exponent;
+            i64 value = v.value;
+            p = put(p, t_decimal, &e, 1);
+            memcpy(p, &value, 8);
+            return p + 8;
+        }
+        else if constexpr(is_same_v<type, double>)
+            return put(p, t_double, &v, 8);
+        else if constexpr(is_integral_v<type> && is_unsigned_v<type>)
+        {
+            u64 value = v;
+            return put(p, t_u64, &value, 8);
+        }
+        else
+        {
+            static_assert(is_integral_v<type>, "binary_log, unsupported argument type");
+            i64 value = v;
+            return put(p, t_i64, &value, 8);
+        }
+    }
+    void commit(ring& r, u32 size);
+
+public:
+    binary_log();
+    binary_log(const binary_log&) = delete;
+    ~binary_log();
+
+    u32 register_format(char_cit format);
+
+    template<typename ... args>
+    void write(u32 format, const args& ... a)
+    {
+        u32 size = (sizeof(record) + ... + arg_size(a));
+        size = (size + 7) & ~7u;
+        ring& r = local_ring();
+        char_it p = reserve(r, size);
+        if(!p) [[unlikely]]
+            return;
+        record* h = (record*)p;
+        h->size = size;
+        h->format = format;
+        h->time = cur_mtime();
+        p += sizeof(record);
+        ((p = put(p, a)), ...);
+        memset(p, 0xff, (char_it)h + size - p);
+        commit(r, size);
+    }
+
+    //takes records committed to rings till now for front() and read(),
+    //frees drained rings of exited threads, single reader
+    void merge();
+    //time of oldest merged record, false if all merged records read
+    bool front(ttime_t& time);
+    //format oldest merged record to s, false if all merged records read
+    bool read(buf_stream& s, ttime_t& time, u32& tid);
+    //records dropped since previous call
+    u64 dropped();
+    static void set_instance(binary_log* b);
+};
+
+extern binary_log* blog_ptr;
+
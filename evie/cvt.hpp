@@ -116,12 +116,103 @@ static const u32 atoi_size_v = atoi_size<type>::value;
 
 i64 read_decimal_impl(char_cit it, char_cit ie, int exponent);
 
+//8 ascii digits, first digit in lowest byte
+inline bool is_digits8(u64 v)
+{
+    return ((v & 0xf0f0f0f0f0f0f0f0ull) | (((v + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4))
+        == 0x3333333333333333ull;
+}
+
+inline u64 read_digits8(u64 v)
+{
+    v -= 0x3030303030303030ull;
+    v = v * 10 + (v >> 8);
+    return (((v & 0x000000ff000000ffull) * (100 + (1000000ull << 32)))
+        + (((v >> 16) & 0x000000ff000000ffull) * (1 + (10000ull << 32)))) >> 32;
+}
+
+//bytes [s, s + n), n <= 8, as 8 digits with leading '0', reads only inside [from, to)
+inline u64 load_digits8(char_cit from, char_cit to, char_cit s, u32 n)
+{
+    if(!n)
+        return 0x3030303030303030ull;
+    u64 v;
+    if(s - from + n >= 8)
+        memcpy(&v, s + n - 8, 8);
+    else if(to - from >= 8)
+    {
+        memcpy(&v, from, 8);
+        v <<= 8 * (8 - (s - from + n));
+    }
+    else
+    {
+        v = 0;
+        for(u32 i = 0; i != n; ++i)
+            v |= u64(u8(s[i])) << (8 * (8 - n + i));
+    }
+    u64 m = ~0ull << (8 * (8 - n));
+    return (v & m) | (0x3030303030303030ull & ~m);
+}
+
+inline char_cit find_dot(char_cit from, char_cit to)
+{
+    if(to - from >= 8)
+    {
+        u64 v;
+        memcpy(&v, from, 8);
+        v ^= 0x2e2e2e2e2e2e2e2eull;
+        u64 z = (v - 0x0101010101010101ull) & ~v & 0x8080808080808080ull;
+        if(z)
+            return from + (__builtin_ctzll(z) >> 3);
+        from += 8;
+    }
+    while(from != to && *from != '.')
+        ++from;
+    return from;
+}
+
+//plain [-]digits[.digits] with up to 8 integer digits parsed by swar,
+//exponents, longer numbers and malformed input go to read_decimal_impl
+template<i64 exponent>
+i64 read_decimal(char_cit it, char_cit ie)
+{
+    static const u32 frac = -exponent;
+    if constexpr(exponent > 0 || frac > 8)
+        return read_decimal_impl(it, ie, exponent);
+    else
+    {
+        char_cit f = it;
+        bool minus = (f != ie && *f == '-');
+        if(minus)
+            ++f;
+        char_cit p = find_dot(f, ie);
+        u32 n_int = p - f, n_frac = (p == ie ? 0 : ie - p - 1), n = min(n_frac, frac);
+        if(n_int > 8 || n_frac > 16) [[unlikely]]
+            return read_decimal_impl(it, ie, exponent);
+
+        u64 i = load_digits8(it, ie, f, n_int), d = load_digits8(it, ie, p + 1, n);
+        if(!is_digits8(i) || !is_digits8(d)) [[unlikely]]
+            return read_decimal_impl(it, ie, exponent);
+        //digits after frac dropped as in read_decimal_impl
+        if(n_frac > frac) [[unlikely]]
+        {
+            for(char_cit c = p + 1 + frac; c != ie; ++c)
+            {
+                if(*c < '0' || *c > '9')
+                    return read_decimal_impl(it, ie, exponent);
+            }
+        }
+        i64 ret = read_digits8(i) * pow10_v<frac> + read_digits8(d) * __pow10[frac - n];
+        return minus ? -ret : ret;
+    }
+}
+
 template<typename decimal>
 inline decimal lexical_cast(char_cit it, char_cit ie)
     requires(is_decimal<decimal>)
 {
     decimal ret;
-    ret.value = read_decimal_impl(it, ie, decimal::exponent);
+    ret.value = read_decimal<decimal::exponent>(it, ie);
     return ret;
 }
 
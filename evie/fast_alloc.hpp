@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "metrics.hpp"
 #include "profiler.hpp"
 #include "string.hpp"
 #include "atomic.hpp"
@@ -582,6 +583,9 @@ using namespace alloc_params;
 static inline void count_slow()
 {
     MPROFILE("fast_alloc::alloc() slow")
+    static const metric allocated("evie_fast_alloc_nodes_total", metrics::counter,
+        "nodes allocated by fast_alloc from heap");
+    allocated.add();
 }
 
 template<typename type, fast_alloc_params params = mt_tss,
@@ -0,0 +1,115 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    histogram, log-linear (HDR-style) histogram of non negative values,
+    values below 2^sub_bits stored exactly, others in 2^sub_bits linear buckets
+    for every power of two (relative error less than 2^-sub_bits),
+    record is constant time, buckets allocated on first record,
+    histogram_t<bits> trades precision for memory ((41 - bits) << bits buckets)
+*/
+
+#pragma once
+
+#include "limits.hpp"
+#include "math.hpp"
+#include "vector.hpp"
+
+template<u32 bits>
+class histogram_t
+{
+public:
+    static const u32 sub_bits = bits, sub_count = 1 << sub_bits, max_bits = 40,
+        buckets = (max_bits - sub_bits + 1) * sub_count;
+
+private:
+    mvector<u64> counts;
+    u64 total;
+    i64 vmin, vmax;
+
+    static u32 index(u64 v)
+    {
+        if(v < sub_count)
+            return v;
+        u32 e = 63 - __builtin_clzll(v);
+        if(e >= max_bits)
+            return buckets - 1;
+        return ((e - sub_bits + 1) << sub_bits) + ((v >> (e - sub_bits)) & (sub_count - 1));
+    }
+    //max value of bucket
+    static i64 value(u32 idx)
+    {
+        if(idx < sub_count)
+            return idx;
+        u32 g = idx >> sub_bits;
+        return (i64(sub_count + (idx & (sub_count - 1))) << (g - 1)) + (i64(1) << (g - 1)) - 1;
+    }
+
+public:
+    histogram_t() : total(), vmin(limits<i64>::max), vmax(limits<i64>::min)
+    {
+    }
+    void clear()
+    {
+        counts.clear();
+        total = 0;
+        vmin = limits<i64>::max;
+        vmax = limits<i64>::min;
+    }
+    //negative values counted in first bucket, min keeps them
+    void record(i64 v)
+    {
+        if(counts.empty()) [[unlikely]]
+            counts.resize(buckets);
+        ++counts[index(v < 0 ? 0 : v)];
+        ++total;
+        vmin = ::min(vmin, v);
+        vmax = ::max(vmax, v);
+    }
+    void add(const histogram_t& r)
+    {
+        if(!r.total)
+            return;
+        if(counts.empty())
+        {
+            counts = r.counts;
+            total = r.total;
+            vmin = r.vmin;
+            vmax = r.vmax;
+            return;
+        }
+        for(u32 i = 0; i != buckets; ++i)
+            counts[i] += r.counts[i];
+        total += r.total;
+        vmin = ::min(vmin, r.vmin);
+        vmax = ::max(vmax, r.vmax);
+    }
+    u64 count() const
+    {
+        return total;
+    }
+    i64 min() const
+    {
+        return vmin;
+    }
+    i64 max() const
+    {
+        return vmax;
+    }
+    //value at percentile p (0-100), upper bound of bucket limited by max
+    i64 percentile(double p) const
+    {
+        if(!total)
+            return 0;
+        u64 rank = u64(p / 100. * total + 0.5), c = 0;
+        rank = ::max<u64>(1, ::min(rank, total));
+        for(u32 i = 0; i != buckets; ++i)
+        {
+            c += counts[i];
+            if(c >= rank)
+                return ::max(vmin, ::min(vmax, value(i)));
+        }
+        return vmax;
+    }
+};
+
+typedef histogram_t<5> histogram;
@@ -0,0 +1,166 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+*/
+
+#include "json.hpp"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    i64 bytes_balance_scalar(char_cit from, char_cit to, char beg, char end)
+    {
+        i64 ret = 0;
+        for(; from != to; ++from)
+        {
+            if(*from == beg)
+                ++ret;
+            else if(*from == end)
+                --ret;
+        }
+        return ret;
+    }
+}
+
+void json_index::build_scalar(char_cit from, char_cit to)
+{
+    this->from = from;
+    this->to = to;
+    pos.__resize<false>(to - from);
+    u32* p = pos.begin();
+    bool str = false;
+    for(char_cit it = from; it != to; ++it)
+    {
+        char c = *it;
+        if(c == '\\')
+        {
+            if(++it == to)
+                break;
+        }
+        else if(c == '"')
+        {
+            str = !str;
+            *p++ = it - from;
+        }
+        else if(str)
+            continue;
+        else if(c == ',' || c == ':' || c == '[' || c == ']' || c == '{' || c == '}')
+            *p++ = it - from;
+    }
+    pos.__resize<false>(p - pos.begin());
+}
+
+#ifdef __AVX2__
+
+namespace
+{
+    u64 mask(__m256i lo, __m256i hi, char c)
+    {
+        __m256i v = _mm256_set1_epi8(c);
+        u64 l = u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, v)));
+        u64 h = u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, v)));
+        return l | (h << 32);
+    }
+
+    //bits of chars escaped by odd backslashes sequence
+    u64 escaped(u64 bs, u64& prev_odd)
+    {
+        static const u64 even_bits = 0x5555555555555555ull, odd_bits = ~even_bits;
+        u64 start_edges = bs & ~(bs << 1);
+        u64 even_start_mask = even_bits ^ prev_odd;
+        u64 even_starts = start_edges & even_start_mask;
+        u64 odd_starts = start_edges & ~even_start_mask;
+        u64 even_carries = bs + even_starts;
+        u64 odd_carries;
+        bool ends_odd = __builtin_add_overflow(bs, odd_starts, &odd_carries);
+        odd_carries |= prev_odd;
+        prev_odd = ends_odd;
+        u64 even_carry_ends = even_carries & ~bs;
+        u64 odd_carry_ends = odd_carries & ~bs;
+        return (even_carry_ends & odd_bits) | (odd_carry_ends & even_bits);
+    }
+
+    u64 prefix_xor(u64 v)
+    {
+#ifdef __PCLMUL__
+        __m128i r = _mm_clmulepi64_si128(_mm_set_epi64x(0, v), _mm_set1_epi8(-1), 0);
+        return _mm_cvtsi128_si64(r);
+#else
+        v ^= v << 1;
+        v ^= v << 2;
+        v ^= v << 4;
+        v ^= v << 8;
+        v ^= v << 16;
+        v ^= v << 32;
+        return v;
+#endif
+    }
+}
+
+void json_index::build(char_cit from, char_cit to)
+{
+    this->from = from;
+    this->to = to;
+    u64 size = to - from;
+    pos.__resize<false>(size + 64);
+    u32* p = pos.begin();
+    u64 prev_odd = 0, prev_str = 0;
+    char buf[64];
+
+    for(u64 b = 0; b < size; b += 64)
+    {
+        char_cit ptr = from + b;
+        if(size - b < 64)
+        {
+            memset(buf, ' ', sizeof(buf));
+            memcpy(buf, ptr, size - b);
+            ptr = buf;
+        }
+        __m256i lo = _mm256_loadu_si256((const __m256i*)ptr);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(ptr + 32));
+
+        u64 esc = escaped(mask(lo, hi, '\\'), prev_odd);
+        u64 quote = mask(lo, hi, '"') & ~esc;
+        u64 str = prefix_xor(quote) ^ prev_str;
+        prev_str = u64(i64(str) >> 63);
+        u64 op = mask(lo, hi, ',') | mask(lo, hi, ':') | mask(lo, hi, '[') | mask(lo, hi, ']')
+            | mask(lo, hi, '{') | mask(lo, hi, '}');
+        u64 bits = (op & ~str & ~esc) | quote;
+        while(bits)
+        {
+            *p++ = b + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+    pos.__resize<false>(p - pos.begin());
+}
+
+i64 bytes_balance(char_cit from, char_cit to, char beg, char end)
+{
+    i64 ret = 0;
+    __m256i vb = _mm256_set1_epi8(beg), ve = _mm256_set1_epi8(end);
+    for(; to - from >= 32; from += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)from);
+        ret += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vb)));
+        ret -= __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ve)));
+    }
+    return ret + bytes_balance_scalar(from, to, beg, end);
+}
+
+#else
+
+void json_index::build(char_cit from, char_cit to)
+{
+    build_scalar(from, to);
+}
+
+i64 bytes_balance(char_cit from, char_cit to, char beg, char end)
+{
+    return bytes_balance_scalar(from, to, beg, end);
+}
+
+#endif
+
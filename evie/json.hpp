@@ -0,0 +1,54 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    json structural index, offsets of quotes not escaped by backslash and of
+    , : [ ] { } outside strings, built by one avx2 pass over 64 bytes blocks
+    (scalar when compiled without avx2), json_cursor jumps between them
+    instead of rescanning frame by find()
+*/
+
+#pragma once
+
+#include "vector.hpp"
+
+struct json_index
+{
+    char_cit from, to;
+    mvector<u32> pos;
+
+    json_index() : from(), to()
+    {
+    }
+    void build(char_cit from, char_cit to);
+    void build_scalar(char_cit from, char_cit to);
+};
+
+struct json_cursor
+{
+    char_cit base, end;
+    const u32* first, *it, *ie;
+
+    json_cursor(const json_index& idx) : base(idx.from), end(idx.to),
+        first(idx.pos.begin()), it(first), ie(idx.pos.end())
+    {
+    }
+    //first structural c at or after from, end if not found
+    char_cit find(char_cit from, char c)
+    {
+        u32 off = from - base;
+        if(it != first && *(it - 1) >= off) [[unlikely]]
+            it = first;
+        while(it != ie && *it < off)
+            ++it;
+        for(; it != ie; ++it)
+        {
+            if(base[*it] == c)
+                return base + *it;
+        }
+        return end;
+    }
+};
+
+//count of beg bytes minus count of end bytes
+i64 bytes_balance(char_cit from, char_cit to, char beg, char end);
+
@@ -0,0 +1,214 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+*/
+
+#include "metrics.hpp"
+#include "mlog.hpp"
+#include "socket.hpp"
+#include "sort.hpp"
+#include "string.hpp"
+
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+static metrics metrics_v;
+metrics* metrics_ptr = &metrics_v;
+
+i64* metrics::register_metric(char_cit name, type t, char_cit help)
+{
+    while(!atomic_compare_exchange(lock, 0u, 1u, __ATOMIC_ACQUIRE))
+        ;
+
+    u32 c = count;
+    for(u32 i = 0; i != c; ++i)
+    {
+        if(!strcmp(slots[i].name, name))
+        {
+            atomic_store(lock, 0u, __ATOMIC_RELEASE);
+            return &slots[i].value;
+        }
+    }
+    if(c == max_metrics)
+    {
+        atomic_store(lock, 0u, __ATOMIC_RELEASE);
+        throw mexception(es() % "metrics::register_metric() overloaded, " % _str_holder(name));
+    }
+
+    slot& s = slots[c];
+    s.name = strdup(name);
+    s.help = strdup(help);
+    s.t = t;
+    atomic_store(count, c + 1, __ATOMIC_RELEASE);
+    atomic_store(lock, 0u, __ATOMIC_RELEASE);
+    return &s.value;
+}
+
+mvector<char> metrics::text() const
+{
+    u32 c = atomic_load(count, __ATOMIC_ACQUIRE);
+    mvector<u32> order(c);
+    for(u32 i = 0; i != c; ++i)
+        order[i] = i;
+    sort(order.begin(), order.end(),
+        [&](u32 l, u32 r) {return strcmp(slots[l].name, slots[r].name) < 0;});
+
+    mvector<char> ret;
+    auto add = [&](str_holder s)
+    {
+        ret.insert(s.begin(), s.end());
+    };
+
+    str_holder prev;
+    for(u32 i: order)
+    {
+        const slot& s = slots[i];
+        str_holder name = _str_holder(s.name);
+        str_holder base(name.begin(), find(name.begin(), name.end(), '{'));
+        if(base != prev)
+        {
+            if(*s.help)
+            {
+                add("# HELP ");
+                add(base);
+                add(" ");
+                add(_str_holder(s.help));
+                add("\n");
+            }
+            add("# TYPE ");
+            add(base);
+            add(s.t == counter ? str_holder(" counter\n") : str_holder(" gauge\n"));
+            prev = base;
+        }
+        add(name);
+        add(" ");
+        add(to_string(atomic_load(s.value)).str());
+        add("\n");
+    }
+    return ret;
+}
+
+mvector<char> metrics::binary() const
+{
+    u32 c = atomic_load(count, __ATOMIC_ACQUIRE);
+    mvector<char> ret;
+    ret.insert((char_cit)&c, (char_cit)&c + sizeof(c));
+    for(u32 i = 0; i != c; ++i)
+    {
+        const slot& s = slots[i];
+        u8 t = s.t;
+        u16 sz = strlen(s.name);
+        i64 v = atomic_load(s.value);
+        ret.insert((char_cit)&t, (char_cit)&t + sizeof(t));
+        ret.insert((char_cit)&sz, (char_cit)&sz + sizeof(sz));
+        ret.insert(s.name, s.name + sz);
+        ret.insert((char_cit)&v, (char_cit)&v + sizeof(v));
+    }
+    return ret;
+}
+
+void metrics::set_instance(metrics* m)
+{
+    metrics_ptr = m;
+}
+
+mstring metric_label(str_holder v)
+{
+    mstring ret;
+    for(char c: v)
+    {
+        if(c == '"' || c == '\\')
+            ret += '\\';
+        if(c == '\n')
+            ret += str_holder("\\n");
+        else
+            ret += c;
+    }
+    return ret;
+}
+
+metrics_server::metrics_server(const mstring& path) : path(path), socket(), can_run(true)
+{
+    sockaddr_un addr = sockaddr_un();
+    if(path.size() >= sizeof(addr.sun_path))
+        throw mexception(es() % "metrics_server, socket path too long: " % path);
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.begin(), path.size());
+
+    socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(socket < 0)
+        throw_system_failure("metrics_server, open socket error");
+    socket_holder sh(socket);
+    unlink(path.c_str());
+    if(bind(socket, (sockaddr*)&addr, sizeof(addr)) < 0)
+        throw_system_failure(es() % "metrics_server, bind " % path % " error");
+    if(listen(socket, 16) < 0)
+        throw_system_failure("metrics_server, listen error");
+    sh.release();
+
+    mlog() << "metrics_server listening " << path;
+    thrd = jthread(&metrics_server::run, this);
+}
+
+void metrics_server::run()
+{
+    pollfd pfd = pollfd();
+    pfd.events = POLLIN;
+    pfd.fd = socket;
+    while(can_run)
+    {
+        int ret = poll(&pfd, 1, 100);
+        if(ret < 0 && errno != EINTR)
+        {
+            mlog(mlog::critical) << "metrics_server, poll error";
+            return;
+        }
+        if(ret <= 0)
+            continue;
+        int c = accept(socket, nullptr, nullptr);
+        if(c < 0)
+            continue;
+
+        socket_holder sh(c);
+        try
+        {
+            char buf[256];
+            int sz = 0;
+            if(check_socket(c, POLLIN, 100, "metrics_server"))
+                sz = ::recv(c, buf, sizeof(buf), MSG_DONTWAIT);
+            str_holder r(buf, sz > 0 ? sz : 0);
+
+            if(r.size() >= 6 && str_holder(r.begin(), 6) == "binary")
+            {
+                mvector<char> d = metrics_ptr->binary();
+                socket_send(c, d.begin(), d.size());
+            }
+            else
+            {
+                mvector<char> d = metrics_ptr->text();
+                if(r.size() >= 3 && str_holder(r.begin(), 3) == "GET")
+                {
+                    mstring h = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: " + to_string(d.size()) + "\r\n\r\n";
+                    socket_send(c, h.begin(), h.size());
+                }
+                socket_send(c, d.begin(), d.size());
+            }
+        }
+        catch(exception& e)
+        {
+            mlog(mlog::warning) << "metrics_server " << e;
+        }
+    }
+}
+
+metrics_server::~metrics_server()
+{
+    can_run = false;
+    thrd.join();
+    ::close(socket);
+    unlink(path.c_str());
+}
+
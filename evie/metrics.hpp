@@ -0,0 +1,103 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    metrics, process wide registry of counters and gauges,
+    values updated by relaxed atomics and sampled by metrics_server without locks,
+    name can contain prometheus labels: name{label="value"},
+    registration of existing name returns the same value
+
+    metrics_server serves registry over unix socket, client sends request line:
+        binary: u32 count, then for every metric u8 type, u16 name size, name, i64 value
+        GET ...: prometheus text exposition in http response
+        anything else: prometheus text exposition
+*/
+
+#pragma once
+
+#include "atomic.hpp"
+#include "mstring.hpp"
+#include "thread.hpp"
+
+class metrics
+{
+public:
+    enum type
+    {
+        counter, gauge
+    };
+
+    static const u32 max_metrics = 1024;
+
+private:
+    struct alignas(64) slot
+    {
+        i64 value;
+        char_cit name;
+        char_cit help;
+        type t;
+    };
+
+    slot slots[max_metrics];
+    u32 count;
+    u32 lock;
+
+public:
+    i64* register_metric(char_cit name, type t, char_cit help);
+    mvector<char> text() const;
+    mvector<char> binary() const;
+    static void set_instance(metrics* m);
+};
+
+extern metrics* metrics_ptr;
+
+struct metric
+{
+    i64* value;
+
+    metric() : value()
+    {
+    }
+    metric(char_cit name, metrics::type t = metrics::counter, char_cit help = "")
+        : value(metrics_ptr->register_metric(name, t, help))
+    {
+    }
+    metric(const mstring& name, metrics::type t = metrics::counter, char_cit help = "")
+        : metric(name.c_str(), t, help)
+    {
+    }
+    void add(i64 v = 1) const
+    {
+        atomic_add(*value, v);
+    }
+    void sub(i64 v = 1) const
+    {
+        atomic_sub(*value, v);
+    }
+    void set(i64 v) const
+    {
+        atomic_store(*value, v);
+    }
+    i64 get() const
+    {
+        return atomic_load(*value);
+    }
+};
+
+//escaped label value for metric name
+mstring metric_label(str_holder v);
+
+class metrics_server
+{
+    mstring path;
+    int socket;
+    volatile bool can_run;
+    jthread thrd;
+
+    void run();
+
+public:
+    metrics_server(const mstring& path);
+    metrics_server(const metrics_server&) = delete;
+    ~metrics_server();
+};
+
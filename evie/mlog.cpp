@@ -7,9 +7,13 @@
 #include "thread.hpp"
 #include "mstring.hpp"
 #include "fast_alloc.hpp"
+#include "metrics.hpp"
+#include "blog.hpp"
+#include "sort.hpp"
 
 #include <stdio.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <unistd.h>
 
 #include <sys/stat.h>
@@ -107,62 +111,175 @@ class simple_log
             }
         }
     }
+    void write_prefix(buf_stream& str, u32 params, u32 pid, u32 tid, ttime_t time)
+    {
+        if(params & mlog::store_pid)
+            str << "pid: " << pid << " ";
+        if(params & mlog::store_tid)
+        {
+            str << "tid: ";
+            if(tid < 10)
+                str << ' ';
+            str << tid << " ";
+        }
+        if(params & mlog::warning)
+            str << "WARNING ";
+        if(params & mlog::error)
+            str << "ERROR ";
+        //rows stamped at commit, producer preempted between stamp and ring store
+        //or max_pending overflow can still give older row, keep written times monotonic
+        if(time < written)
+            time = written;
+        written = time;
+        str << time << ": ";
+    }
+    void write_row(buf_stream& str, str_holder row, u32 params, u32 tid, ttime_t time,
+        u32 all_sz, bool& first)
+    {
+        str.clear();
+        write_prefix(str, params, pid, tid, time);
+        write_impl(str.begin(), str.size(), params, all_sz, first);
+        write_impl(row.begin(), row.size(), params, all_sz, first);
+        write_impl("\n", 1, params, all_sz, first);
+    }
+    void write_data(mstream& str, mlog::data* data, u32 all_sz, bool& first)
+    {
+        if(!(data->params & mlog::only_cout))
+        {
+            str.clear();
+            write_prefix(str, data->params, data->pid, data->tid, data->time);
+            write_impl(str.begin(), str.size(), data->params, all_sz, first);
+        }
+
+        mlog::node* head = &data->head;
+
+        while(head)
+        {
+            mlog::node* next = head->next;
+            write_impl(head->buf, head->size, data->params, all_sz, first);
+            if(head != &data->head)
+                pool.free(head);
+            head = next;
+        }
+
+        if(!(data->params & mlog::only_cout))
+            write_impl("\n", 1, data->params, all_sz, first);
+
+        free_buf(data);
+    }
+    //move rows from thread rings to pending, sorted by time (rows of thread keep order),
+    //free rings of exited threads when all their rows written
+    u64 collect(mvector<mlog::data*>& pending, mvector<pair<mlog::data*, u64> >& fresh,
+        mvector<mlog::data*>& merged, mstream& str)
+    {
+        u64 ret = 0, dropped = 0;
+        fresh.clear();
+        ring* prev = nullptr;
+        for(ring* r = atomic_load(rings, __ATOMIC_ACQUIRE); r;)
+        {
+            ring* next = r->next;
+            bool exited = atomic_load(r->refs, __ATOMIC_ACQUIRE) == 1;
+            u64 h = atomic_load(r->head, __ATOMIC_ACQUIRE);
+            r->pending += h - r->tail;
+            for(u64 t = r->tail; t != h; ++t, ++ret)
+                fresh.push_back({r->rows[t % ring::size], ret});
+            atomic_store(r->tail, h, __ATOMIC_RELEASE);
+            dropped += atomic_exchange(&r->dropped, u64(0));
+            if(exited && !r->pending)
+            {
+                unlink(prev, r);
+                free_rows(r);
+                delete r;
+            }
+            else
+                prev = r;
+            r = next;
+        }
+        if(ret)
+        {
+            sort(fresh.begin(), fresh.end(), [](const pair<mlog::data*, u64>& l, const pair<mlog::data*, u64>& r)
+                {return l.first->time < r.first->time || (l.first->time == r.first->time && l.second < r.second);});
+            merged.clear();
+            mlog::data** p = pending.begin(), **pe = pending.end();
+            for(const pair<mlog::data*, u64>& f: fresh)
+            {
+                for(; p != pe && !(f.first->time < (*p)->time); ++p)
+                    merged.push_back(*p);
+                merged.push_back(f.first);
+            }
+            merged.insert(p, pe);
+            pending.swap(merged);
+        }
+        if(dropped)
+        {
+            bool first = true;
+            buf_stream_fixed<128> msg;
+            msg << "mlog dropped " << dropped << " rows, thread ring overloaded";
+            write_row(str, msg.str(), params | mlog::warning, get_thread_id(), cur_mtime(),
+                0, first);
+        }
+        return ret;
+    }
+    //write pending rows and binary_log records older than hold_back, all of them on exit
+    u32 proceed(mvector<mlog::data*>& pending, mstream& str, buf_stream& row, bool all)
+    {
+        ttime_t limit = all ? ttime_t{limits<i64>::max} : cur_mtime() - hold_back;
+        if(pending.size() > max_pending)
+            limit = pending[pending.size() - max_pending]->time;
+
+        mlog::data** from = pending.begin(), **to = lower_bound(pending.begin(), pending.end(),
+            limit, [](const mlog::data* l, ttime_t r) {return l->time < r;});
+        u32 all_sz = to - from, ret = 0;
+        bool first = true;
+        ttime_t bt;
+        if(blog)
+            blog->merge();
+        for(;; ++ret)
+        {
+            bool b = blog && blog->front(bt) && bt < limit;
+            if(from != to && (!b || !(bt < (*from)->time)))
+                write_data(str, *from++, all_sz, first);
+            else if(b)
+            {
+                u32 tid;
+                row.clear();
+                blog->read(row, bt, tid);
+                write_row(str, row.str(), params, tid, bt, 0, first);
+            }
+            else
+                break;
+        }
+        pending.erase(pending.begin(), to);
+        if(blog)
+        {
+            if(u64 d = blog->dropped())
+            {
+                row.clear();
+                row << "binary_log dropped " << d << " records";
+                write_row(str, row.str(), params | mlog::warning, get_thread_id(),
+                    cur_mtime(), 0, first);
+                ++ret;
+            }
+        }
+        return ret;
+    }
     void write_thred()
     {
         set_trash_thread();
-        u32 writed_sz = 0;
         try
         {
-            mlog::data* data;
-            static const u32 cntr_from = 128, cntr_to = 524288;
+            //rings are bounded, so idle sleep limited by hold_back
+            static const u32 cntr_from = 128, cntr_to = 1024;
             u32 cntr = 128;
             mstream str;
+            buf_stream_fixed<64 * 1024> row;
+            mvector<mlog::data*> pending, merged;
+            mvector<pair<mlog::data*, u64> > fresh;
             for(;;)
             {
-                u32 all_sz = atomic_load(all_size) - writed_sz;
-                bool first = true;
-                for(u32 cur_i = 0; cur_i != all_sz; ++cur_i)
-                {
-                    data = nodes.pop();
-
-                    if(!(data->params & mlog::only_cout))
-                    {
-                        str.clear();
-                        if(data->params & mlog::store_pid)
-                            str << "pid: " << data->pid << " ";
-                        if(data->params & mlog::store_tid)
-                        {
-                            u32 tid = data->tid;
-                            str << "tid: ";
-                            if(tid < 10)
-                                str << ' ';
-                            str << tid << " ";
-                        }
-                        if(data->params & mlog::warning)
-                            str << "WARNING ";
-                        if(data->params & mlog::error)
-                            str << "ERROR ";
-                        str << data->time << ": ";
-                        write_impl(str.begin(), str.size(), data->params, all_sz, first);
-                    }
-
-                    mlog::node* head = &data->head;
-
-                    while(head)
-                    {
-                        mlog::node* next = head->next;
-                        write_impl(head->buf, head->size, data->params, all_sz, first);
-                        if(head != &data->head)
-                            pool.free(head);
-                        head = next;
-                    }
-
-                    if(!(data->params & mlog::only_cout))
-                        write_impl("\n", 1, data->params, all_sz, first);
-
-                    nodes.free(data);
-                    ++writed_sz;
-                }
+                bool stop = !can_run;
+                collect(pending, fresh, merged, str);
+                u32 all_sz = proceed(pending, str, row, stop);
                 if(all_sz)
                 {
                     if(cntr != cntr_from)
@@ -172,13 +289,14 @@ class simple_log
                     if(!!stream_crit)
                         stream_crit->flush(true);
                 }
-                if(!all_sz && !can_run)
+                if(stop)
                     break;
                 if(!all_sz)
                 {
                     pool.run_once();
-                    usleep(cntr);
-                    if(cntr != cntr_to)
+                    scoped_lock lock(wake_mutex);
+                    wake_cond.timed_uwait(lock, pending.empty() ? cntr : cntr_from);
+                    if(cntr != cntr_to && pending.empty())
                         cntr *= 2;
                 }
             }
@@ -188,26 +306,114 @@ class simple_log
             cout_write(es() % "simple_log::write_thread error: "
                 % _str_holder(e.what()) % endl);
         }
+        writing = false;
+    }
+
+    //single producer single consumer rows queue and free rows stack of one thread
+    struct ring
+    {
+        static const u32 size = 4096;
+
+        mlog::data* rows[size];
+        u64 head, tail, dropped;
+        mlog::data* free_rows[size];
+        u64 free_head, free_tail;
+        u64 pending; //collected and not written rows, writer thread only
+        u32 refs; //owner thread and simple_log
+        ring* next;
+    };
+
+    static const u32 max_pending = 64 * 1024;
+    static constexpr ttime_t hold_back = milliseconds(1);
+
+    ring& local_ring();
+    static void release(void* r)
+    {
+        if(!atomic_sub(((ring*)r)->refs, 1u, __ATOMIC_ACQ_REL))
+            delete (ring*)r;
+    }
+    //producers only push to rings head
+    void unlink(ring* prev, ring* r)
+    {
+        if(!prev)
+        {
+            for(;;)
+            {
+                if(atomic_compare_exchange(rings, r, r->next))
+                    return;
+                prev = atomic_load(rings, __ATOMIC_ACQUIRE);
+                if(prev != r)
+                    break;
+            }
+            while(prev->next != r)
+                prev = prev->next;
+        }
+        prev->next = r->next;
+    }
+    static void free_rows(ring* r)
+    {
+        for(u64 i = r->free_tail; i != r->free_head; ++i)
+            delete r->free_rows[i % ring::size];
+        r->free_tail = r->free_head;
+    }
+    //yield lets writer drain ring when it shares cpu with producer
+    void wake()
+    {
+        bool lock = wake_mutex.try_lock();
+        wake_cond.notify_one();
+        if(lock)
+            wake_mutex.unlock();
+        sched_yield();
+    }
+    void free_buf(mlog::data* buf)
+    {
+        ring& r = *(ring*)buf->owner;
+        --r.pending;
+        u64 h = r.free_head;
+        if(h - atomic_load(r.free_tail, __ATOMIC_ACQUIRE) == ring::size)
+            delete buf;
+        else
+        {
+            r.free_rows[h % ring::size] = buf;
+            atomic_store(r.free_head, h + 1, __ATOMIC_RELEASE);
+        }
+    }
+    void free_chain(mlog::data* buf)
+    {
+        mlog::node* head = buf->head.next;
+        while(head)
+        {
+            mlog::node* next = head->next;
+            pool.free(head);
+            head = next;
+        }
     }
 
     unique_ptr<ofile> stream, stream_crit;
-    volatile bool can_run;
-    u32 all_size;
-    fast_alloc_list<mlog::data, mt> nodes;
+    volatile bool can_run, writing;
+    const u64 uid;
+    ring* rings;
     fast_alloc<mlog::node, mt> pool;
+    ::mutex wake_mutex;
+    condition wake_cond;
     jthread work_thread;
     static simple_log* log;
 
     void* free_threads;
     ::profiler* profiler;
+    binary_log* blog;
+    u32 pid;
+    ::metrics* metrics;
+    tsc_clock* tsc;
+    ttime_t written; //time of last written row, writer thread only
 
 public:
     volatile bool no_cout;
     u32 params;
 
     simple_log(char_cit file_name, u32 params, bool set_instance)
-        : can_run(true), all_size(), nodes("mlog::nodes"),
-        no_cout(), params(params)
+        : can_run(true), writing(true), uid(atomic_add(instances, u64(1))), rings(),
+        blog(), pid(getpid()), metrics(metrics_ptr), tsc(&tsc_clock_v), written(), no_cout(), params(params)
     {
         log = nullptr;
         if(file_name)
@@ -231,17 +437,36 @@ public:
             log = this;
             free_threads = init_free_threads();
             profiler = new ::profiler;
+            blog = new binary_log;
+            blog_ptr = blog;
+            tsc_init();
+            if(char_cit f = getenv("profiler_trace"))
+                profiler->start_trace(f);
         }
         work_thread = jthread(&simple_log::write_thred, this);
     }
     ~simple_log()
     {
+        if(profiler)
+        {
+            profiler->stop_dumps();
+            profiler->stop_trace();
+        }
         if(!(params & mlog::no_profiler))
             profiler->print(mlog::info);
 
         can_run = false;
         work_thread.join();
+        while(rings)
+        {
+            ring* r = rings;
+            rings = r->next;
+            free_rows(r);
+            release(r);
+        }
         delete profiler;
+        blog_ptr = nullptr;
+        delete blog;
         delete_free_threads(free_threads);
     }
     mlog::node* alloc()
@@ -253,7 +478,17 @@ public:
     }
     mlog::data* alloc_buf()
     {
-        mlog::data* buf = nodes.alloc();
+        ring& r = local_ring();
+        mlog::data* buf;
+        u64 t = r.free_tail;
+        if(t != atomic_load(r.free_head, __ATOMIC_ACQUIRE))
+        {
+            buf = r.free_rows[t % ring::size];
+            atomic_store(r.free_tail, t + 1, __ATOMIC_RELEASE);
+        }
+        else
+            buf = new mlog::data;
+        buf->owner = &r;
         return buf;
     }
     static void set_instance(simple_log* l)
@@ -261,19 +496,88 @@ public:
         log = l;
         set_free_threads(l->free_threads);
         profiler::set_instance(l->profiler);
+        binary_log::set_instance(l->blog);
+        metrics::set_instance(l->metrics);
+        tsc_init(l->tsc);
     };
     static simple_log& instance()
     {
         return *log;
     }
+    //full ring drops row, critical rows wait for writer thread,
+    //more than half full ring wakes writer every 256 rows
     void write(mlog::data* buf)
     {
-        nodes.push_back(buf);
-        atomic_add(all_size, 1u);
+        ring& r = *(ring*)buf->owner;
+        for(;;)
+        {
+            u64 h = r.head, used = h - atomic_load(r.tail, __ATOMIC_ACQUIRE);
+            if(used != ring::size) [[likely]]
+            {
+                //stamp at commit, rows built slowly keep order with rows of other threads
+                buf->time = cur_mtime();
+                r.rows[h % ring::size] = buf;
+                atomic_store(r.head, h + 1, __ATOMIC_RELEASE);
+                if(used >= ring::size / 2 && !(used % 256)) [[unlikely]]
+                    wake();
+                return;
+            }
+            if(!(buf->params & mlog::critical) || !writing)
+            {
+                atomic_add(r.dropped, u64(1));
+                free_chain(buf);
+                delete buf;
+                return;
+            }
+            usleep(100);
+        }
     }
+
+    static u64 instances;
 };
 
 simple_log* simple_log::log = 0;
+u64 simple_log::instances = 0;
+
+namespace
+{
+    thread_local u64 ring_owner;
+    thread_local void* ring_ptr;
+
+    //drops thread reference of ring at thread exit
+    struct ring_exit
+    {
+        void* ring;
+        void (*release)(void*);
+
+        ~ring_exit()
+        {
+            ring_owner = 0;
+            if(ring)
+                release(ring);
+        }
+    };
+    thread_local ring_exit ring_holder;
+}
+
+simple_log::ring& simple_log::local_ring()
+{
+    if(ring_owner != uid + 1) [[unlikely]]
+    {
+        if(ring_holder.ring)
+            ring_holder.release(ring_holder.ring);
+        ring* r = new ring;
+        r->head = r->tail = r->dropped = r->free_head = r->free_tail = r->pending = 0;
+        r->refs = 2;
+        do
+            r->next = atomic_load(rings);
+        while(!atomic_compare_exchange(rings, r->next, r, __ATOMIC_RELEASE));
+        ring_holder = {r, &simple_log::release};
+        ring_ptr = r;
+        ring_owner = uid + 1;
+    }
+    return *(ring*)ring_ptr;
+}
 
 void mlog::init(u32 extra_param)
 {
@@ -283,7 +587,6 @@ void mlog::init(u32 extra_param)
     buf->head.size = 0;
     buf->tail = &buf->head;
 
-    buf->time = cur_mtime();
     if(buf->params & mlog::store_pid)
         buf->pid = getpid();
     if(buf->params & mlog::store_tid)
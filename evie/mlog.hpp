@@ -23,11 +23,12 @@ struct mlog : ios_base
 
     struct data
     {
-        ttime_t time;
+        ttime_t time; //set at commit by ~mlog
         u32 pid, tid;
         node head;
         node* tail;
         u32 params;
+        void* owner;
     };
 
 private:
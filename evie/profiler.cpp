@@ -8,14 +8,143 @@
 #include "mtime.hpp"
 #include "mlog.hpp"
 #include "sort.hpp"
+#include "thread.hpp"
+#include "vector.hpp"
+#include "mstring.hpp"
+#include "string.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 profiler* profiler_ptr;
 
+namespace
+{
+    u64 instances;
+    thread_local u64 shard_owner;
+    thread_local void* shard_ptr;
+
+    //drops thread reference of shard at thread exit
+    struct shard_exit
+    {
+        void* shard;
+        void (*release)(void*);
+
+        ~shard_exit()
+        {
+            shard_owner = 0;
+            if(shard)
+                release(shard);
+        }
+    };
+    thread_local shard_exit shard_holder;
+
+    u32 bucket(i64 v)
+    {
+        return v <= 0 ? 0 : 64 - __builtin_clzll(v);
+    }
+
+    struct profiler_dumper
+    {
+        mutex m;
+        condition cv;
+        bool can_run = true;
+        jthread thrd;
+    };
+
+    typedef profiler_dumper profiler_tracer;
+
+    struct trace_writer
+    {
+        int hfile;
+        bool first;
+        u32 pid;
+        u64 events, dropped;
+        mvector<char> buf;
+        buf_stream_fixed<1024> s;
+
+        trace_writer() : hfile(-1), first(), pid(getpid()), events(), dropped()
+        {
+        }
+        void write_buf()
+        {
+            if(!buf.empty() && ::write(hfile, buf.begin(), buf.size()) != ssize_t(buf.size()))
+                throw_system_failure("profiler trace writing error");
+            buf.clear();
+        }
+        void append(str_holder str)
+        {
+            buf.insert(str.begin(), str.end());
+            if(buf.size() > 1024 * 1024)
+                write_buf();
+        }
+        void time(ttime_t t)
+        {
+            u32 ns = t.value % 1000;
+            s << t.value / 1000 << '.' << char('0' + ns / 100) << char('0' + ns / 10 % 10)
+                << char('0' + ns % 10);
+        }
+        void add(char_cit name, u32 tid, ttime_t from, ttime_t to)
+        {
+            s.clear();
+            if(!first)
+                s << ",\n";
+            first = false;
+            s << "{\"name\":\"";
+            for(; *name && s.size() < 512; ++name)
+            {
+                if(*name == '"' || *name == '\\')
+                    s << '\\';
+                s << *name;
+            }
+            s << "\",\"cat\":\"profiler\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":";
+            time(from);
+            s << ",\"dur\":";
+            time(to - from);
+            s << "}";
+            append(s.str());
+            ++events;
+        }
+    };
+}
+
 profiler::info::info() : time(), time_max(),
-    time_min(limits<ttime_t>::max), count(), name()
+    time_min(limits<ttime_t>::max), count(), hist()
 {
 }
 
+void profiler::info::add(const info& r)
+{
+    time += r.time;
+    time_max = max(time_max, r.time_max);
+    time_min = min(time_min, r.time_min);
+    count += r.count;
+    for(u64 b = 0; b != buckets; ++b)
+        hist[b] += r.hist[b];
+}
+
+void profiler::info::sub(const info& r)
+{
+    time -= r.time;
+    count -= r.count;
+    for(u64 b = 0; b != buckets; ++b)
+        hist[b] -= r.hist[b];
+}
+
+//upper bound of bucket with p percentile, limited by max
+ttime_t profiler::info::percentile(u32 p) const
+{
+    u64 rank = max<u64>(1, (count * p + 99) / 100), c = 0;
+    for(u64 b = 0; b != buckets; ++b)
+    {
+        c += hist[b];
+        if(c >= rank)
+            return min(time_max, ttime_t{b ? i64((u64(1) << b) - 1) : 0});
+    }
+    return time_max;
+}
+
 struct print_count
 {
     ttime_t value;
@@ -27,43 +156,138 @@ mlog& operator<<(mlog& m, print_count t)
     return m;
 }
 
-void profiler::print(long mlog_params)
+void profiler::free_shard(shard* s)
 {
-    u64 ncounters = atomic_load(cur_counters);
-    if(!ncounters)
-        return;
+    for(info* i: s->counters)
+        delete[] i;
+    delete s->events;
+    delete s;
+}
+
+void profiler::release(void* p)
+{
+    shard* s = (shard*)p;
+    if(!atomic_sub(s->refs, 1u, __ATOMIC_ACQ_REL))
+        free_shard(s);
+}
+
+//threads only push to list head
+void profiler::unlink(shard* prev, shard* s)
+{
+    if(!prev)
+    {
+        for(;;)
+        {
+            if(atomic_compare_exchange(shards, s, s->next))
+                return;
+            prev = atomic_load(shards, __ATOMIC_ACQUIRE);
+            if(prev != s)
+                break;
+        }
+        while(prev->next != s)
+            prev = prev->next;
+    }
+    prev->next = s->next;
+}
+
+void profiler::retire(shard* s)
+{
+    if(!retired)
+        retired = new shard();
+    for(u64 p = 0; p != pages; ++p)
+    {
+        const info* i = s->counters[p];
+        if(!i)
+            continue;
+        info*& r = retired->counters[p];
+        if(!r)
+            r = new info[page_counters];
+        for(u64 c = 0; c != page_counters; ++c)
+            r[c].add(i[c]);
+    }
+    free_shard(s);
+}
 
-    info counters_cpy[max_counters];
-    copy(counters, counters + ncounters, counters_cpy);
-    sort(counters_cpy, counters_cpy + ncounters,
-        [](const info& l, const info& r)
+//free shards of exited threads with trace events drained by trace_flush,
+//walk lock should be held
+void profiler::collect()
+{
+    shard* prev = nullptr;
+    for(shard* s = atomic_load(shards, __ATOMIC_ACQUIRE); s;)
+    {
+        shard* next = s->next;
+        bool exited = atomic_load(s->refs, __ATOMIC_ACQUIRE) == 1;
+        if(exited && s->events)
+            exited = s->events->tail == s->events->head;
+        if(exited)
         {
-            if(l.type == r.type)
-                return strcmp(l.name, r.name) < 0;
+            unlink(prev, s);
+            retire(s);
+        }
+        else
+            prev = s;
+        s = next;
+    }
+}
+
+void profiler::merge(info* to, u64 ncounters)
+{
+    mutex::scoped_lock lock(walk);
+    collect();
+    auto add = [&](const shard* s)
+    {
+        for(u64 p = 0; p * page_counters < ncounters; ++p)
+        {
+            const info* i = atomic_load(s->counters[p], __ATOMIC_ACQUIRE);
+            if(i)
+                for(u64 c = p * page_counters; c != min(ncounters, (p + 1) * page_counters); ++c)
+                    to[c].add(i[c % page_counters]);
+        }
+    };
+    for(shard* s = atomic_load(shards, __ATOMIC_ACQUIRE); s; s = s->next)
+        add(s);
+    if(retired)
+        add(retired);
+}
+
+void profiler::print(long mlog_params, const info* values, u64 ncounters, bool delta)
+{
+    mvector<u64> order(ncounters);
+    for(u64 c = 0; c != ncounters; ++c)
+        order[c] = c;
+    sort(order.begin(), order.end(),
+        [&](u64 l, u64 r)
+        {
+            if(counters[l].type == counters[r].type)
+                return strcmp(counters[l].name, counters[r].name) < 0;
             else
-                return l.type < r.type;
+                return counters[l].type < counters[r].type;
         }
     );
 
     mlog log(mlog_params);
-    log << "profiler: \n";
+    if(delta)
+        log << "profiler delta: \n";
+    else
+        log << "profiler: \n";
 
-    for(u64 c = 0; c != ncounters; ++c)
+    for(u64 c: order)
     {
-        const info i = counters_cpy[c];
+        const info& i = values[c];
         if(!i.count)
             continue;
 
         auto f = [&]<typename type>(type, auto av)
         {
-            log << _str_holder(i.name) << ": avg: " << av
-                << ", min: " << type{i.time_min} << ", max: "
-                <<  type{i.time_max}
-                << ", all: " << type{i.time} << ", count: "
-                << i.count << endl;
+            log << _str_holder(counters[c].name) << ": avg: " << av;
+            if(!delta)
+                log << ", min: " << type{i.time_min};
+            log << ", p50: " << type{i.percentile(50)} << ", p99: " << type{i.percentile(99)}
+                << ", max: " << type{delta ? i.percentile(100) : i.time_max}
+                << ", all: " << type{i.time} << ", count: " << i.count << endl;
         };
 
-        if(i.type == time)
+        if(counters[c].type == time)
         {
             ttime_t time_av = div_int(i.time, i.count);
             f(print_t(), print_t{time_av});
@@ -79,7 +303,52 @@ void profiler::print(long mlog_params)
     }
 }
 
-profiler::profiler() : cur_counters()
+void profiler::print(long mlog_params)
+{
+    u64 ncounters = atomic_load(cur_counters);
+    if(!ncounters)
+        return;
+
+    mvector<info> values(ncounters);
+    for(info& i: values)
+        i = info();
+    merge(values.begin(), ncounters);
+    print(mlog_params, values.begin(), ncounters, false);
+}
+
+void profiler::dump(u32 period)
+{
+    profiler_dumper& d = *(profiler_dumper*)dumper;
+    mvector<info> values, prev;
+    mutex::scoped_lock lock(d.m);
+    while(d.can_run)
+    {
+        d.cv.timed_wait(lock, period);
+        if(!d.can_run)
+            break;
+
+        u64 ncounters = atomic_load(cur_counters);
+        values.resize(ncounters);
+        for(info& i: values)
+            i = info();
+        merge(values.begin(), ncounters);
+
+        u64 nprev = prev.size();
+        prev.resize(ncounters);
+        for(u64 c = nprev; c != ncounters; ++c)
+            prev[c] = info();
+        for(u64 c = 0; c != ncounters; ++c)
+        {
+            info cur = values[c];
+            values[c].sub(prev[c]);
+            prev[c] = cur;
+        }
+        print(mlog::info, values.begin(), ncounters, true);
+    }
+}
+
+profiler::profiler() : counters(), cur_counters(), shards(), retired(), dumper(), tracer(),
+    uid(atomic_add(instances, u64(1))), tracing()
 {
     profiler_ptr = this;
 }
@@ -98,7 +367,7 @@ u64 profiler::register_counter(char_cit id, type t)
             throw_exception("profiler::register_counter, overloaded");
         }
 
-        info& i = counters[c];
+        counter& i = counters[c];
         if(atomic_compare_exchange<char_cit>(i.name, nullptr, cid))
         {
             i.type = t;
@@ -108,29 +377,204 @@ u64 profiler::register_counter(char_cit id, type t)
     }
 }
 
+profiler::shard& profiler::local_shard()
+{
+    if(shard_owner != uid) [[unlikely]]
+    {
+        if(shard_holder.shard)
+            shard_holder.release(shard_holder.shard);
+        //new threads free shards of exited ones, without waiting for print or dumps
+        if(walk.try_lock())
+        {
+            collect();
+            walk.unlock();
+        }
+        shard* s = new shard();
+        s->tid = gettid();
+        s->refs = 2;
+        do
+            s->next = atomic_load(shards);
+        while(!atomic_compare_exchange(shards, s->next, s, __ATOMIC_RELEASE));
+        shard_holder = {s, &profiler::release};
+        shard_ptr = s;
+        shard_owner = uid;
+    }
+    return *(shard*)shard_ptr;
+}
+
+profiler::info& profiler::get(u64 counter_id)
+{
+    shard* s = &local_shard();
+    info*& p = s->counters[counter_id / page_counters];
+    if(!p) [[unlikely]]
+        atomic_store(p, new info[page_counters], __ATOMIC_RELEASE);
+    return p[counter_id % page_counters];
+}
+
 void profiler::add(u64 counter_id, ttime_t time)
 {
-    info& i = counters[counter_id];
+    info& i = get(counter_id);
     i.time += time;
+    i.time_max = max(i.time_max, time);
+    i.time_min = min(i.time_min, time);
+    ++i.count;
+    ++i.hist[bucket(time.value)];
+}
 
-    ttime_t t;
-    do
+void profiler::start_dumps(u32 period)
+{
+    if(dumper || !period)
+        return;
+    profiler_dumper* d = new profiler_dumper;
+    dumper = d;
+    d->thrd = jthread(&profiler::dump, this, period);
+}
+
+void profiler::stop_dumps()
+{
+    profiler_dumper* d = (profiler_dumper*)dumper;
+    if(!d)
+        return;
     {
-        t = atomic_load(i.time_max);
-        if(time <= t)
-            break;
+        mutex::scoped_lock lock(d->m);
+        d->can_run = false;
+        d->cv.notify_all();
     }
-    while(!atomic_compare_exchange(i.time_max, t, time));
+    d->thrd.join();
+    delete d;
+    dumper = nullptr;
+}
 
-    do
+void profiler::trace(u64 counter_id, ttime_t from, ttime_t to)
+{
+    if(counters[counter_id].type != time)
+        return;
+    shard& s = local_shard();
+    trace_events* e = s.events;
+    if(!e) [[unlikely]]
+    {
+        e = new trace_events();
+        atomic_store(s.events, e, __ATOMIC_RELEASE);
+    }
+    u64 h = e->head;
+    if(h - atomic_load(e->tail, __ATOMIC_ACQUIRE) == trace_events::size) [[unlikely]]
+    {
+        atomic_add(e->dropped, u64(1));
+        return;
+    }
+    e->events[h % trace_events::size] = {counter_id, from, to};
+    atomic_store(e->head, h + 1, __ATOMIC_RELEASE);
+}
+
+void profiler::trace_flush(void* writer)
+{
+    trace_writer& w = *(trace_writer*)writer;
     {
-        t = atomic_load(i.time_min);
-        if(time >= t)
+        mutex::scoped_lock lock(walk);
+        for(shard* s = atomic_load(shards, __ATOMIC_ACQUIRE); s; s = s->next)
+        {
+            trace_events* e = atomic_load(s->events, __ATOMIC_ACQUIRE);
+            if(!e)
+                continue;
+            u64 h = atomic_load(e->head, __ATOMIC_ACQUIRE);
+            if(w.hfile >= 0)
+            {
+                for(u64 i = e->tail; i != h; ++i)
+                {
+                    const trace_events::event& v = e->events[i % trace_events::size];
+                    w.add(counters[v.counter_id].name, s->tid, v.from, v.to);
+                }
+                w.dropped += atomic_exchange(&e->dropped, u64(0));
+            }
+            atomic_store(e->tail, h, __ATOMIC_RELEASE);
+        }
+        collect();
+    }
+    if(w.hfile >= 0)
+        w.write_buf();
+}
+
+void profiler::trace_run(char_it file)
+{
+    profiler_tracer& t = *(profiler_tracer*)tracer;
+    mstring base = _str_holder(file);
+    free(file);
+    trace_writer w;
+    u32 session = 0;
+
+    mutex::scoped_lock lock(t.m);
+    for(;;)
+    {
+        bool run = t.can_run, on = run && tracing;
+        try
+        {
+            if(on && w.hfile < 0)
+            {
+                mstring name = session ? base + "." + to_string(session) : base;
+                ++session;
+                w.hfile = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IWRITE | S_IREAD | S_IRGRP | S_IROTH);
+                if(w.hfile < 0)
+                    throw_system_failure(es() % "profiler trace, open " % name % " error");
+                w.first = true;
+                w.events = w.dropped = 0;
+                w.append("{\"traceEvents\":[\n");
+                mlog() << "profiler trace to " << name << " started";
+            }
+            trace_flush(&w);
+            if(!on && w.hfile >= 0)
+            {
+                w.append("\n],\"displayTimeUnit\":\"ns\"}\n");
+                w.write_buf();
+                ::close(w.hfile);
+                w.hfile = -1;
+                mlog() << "profiler trace stopped, events: " << w.events << ", dropped: " << w.dropped;
+            }
+        }
+        catch(exception& e)
+        {
+            mlog(mlog::critical) << "profiler::trace_run() " << e;
+            if(w.hfile >= 0)
+                ::close(w.hfile);
+            w.hfile = -1;
+            w.buf.clear();
+            tracing = false;
+        }
+        if(!run)
             break;
+        t.cv.timed_uwait(lock, 50 * 1000);
     }
-    while(!atomic_compare_exchange(i.time_min, t, time));
+}
 
-    ++i.count;
+void profiler::start_trace(char_cit file)
+{
+    if(tracer)
+        return;
+    profiler_tracer* t = new profiler_tracer;
+    tracer = t;
+    tracing = true;
+    t->thrd = jthread(&profiler::trace_run, this, strdup(file));
+}
+
+void profiler::stop_trace()
+{
+    profiler_tracer* t = (profiler_tracer*)tracer;
+    if(!t)
+        return;
+    tracing = false;
+    {
+        mutex::scoped_lock lock(t->m);
+        t->can_run = false;
+        t->cv.notify_all();
+    }
+    t->thrd.join();
+    delete t;
+    tracer = nullptr;
+}
+
+void profiler::switch_trace()
+{
+    if(tracer)
+        tracing = !tracing;
 }
 
 void profiler::set_instance(profiler* p)
@@ -141,8 +585,17 @@ void profiler::set_instance(profiler* p)
 
 profiler::~profiler()
 {
+    stop_dumps();
+    stop_trace();
     profiler_ptr = nullptr;
     for(u64 c = 0; c != cur_counters; ++c)
         free((char_it)counters[c].name);
+    for(shard* s = shards; s;)
+    {
+        shard* n = s->next;
+        release(s);
+        s = n;
+    }
+    if(retired)
+        free_shard(retired);
 }
-
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "time.hpp"
+#include "thread.hpp"
 
 #define CONCAT_(a, b) a##b
 #define CONCAT(a, b) CONCAT_(a, b)
@@ -24,27 +25,84 @@
 #define MPROFILE_USER(id, value) MPROFILE_TYPE(id, time, value)
 #define MPROFILE_COUNT(id, value) MPROFILE_TYPE(id, count, value)
 
+//counters updated in per thread shards and merged on print,
+//shards of exited threads folded to retired shard and freed by print, dumps and tracer,
+//every counter keeps log2 histogram of values,
+//in trace mode (switched by SIGUSR2 when started by start_trace) time scopes also
+//written to per thread rings and flushed by background thread to chrome trace json
 class profiler
 {
-    static const u64 max_counters = 100;
+    static const u64 max_counters = 4096, page_counters = 64, pages = max_counters / page_counters,
+        buckets = 64;
+
+    struct counter
+    {
+        const char* name;
+        int type;
+    };
 
     struct info
     {
         ttime_t time, time_max, time_min;
         i64 count;
-        const char* name;
-        int type;
+        u64 hist[buckets];
 
         info();
+        void add(const info& r);
+        void sub(const info& r);
+        ttime_t percentile(u32 p) const;
     };
 
-    info counters[max_counters];
+    struct trace_events
+    {
+        static const u64 size = 64 * 1024;
+
+        struct event
+        {
+            u64 counter_id;
+            ttime_t from, to;
+        };
+
+        event events[size];
+        u64 head, tail, dropped;
+    };
+
+    struct shard
+    {
+        info* counters[pages];
+        trace_events* events;
+        u32 tid, refs; //refs: writer thread and profiler
+        shard* next;
+    };
+
+    counter counters[max_counters];
     u64 cur_counters;
+    shard* shards;
+    shard* retired;
+    mutex walk; //shards walkers: merge, trace_flush and collect
+    void* dumper;
+    void* tracer;
+    const u64 uid;
 
     profiler();
     friend class simple_log;
 
+    static void free_shard(shard* s);
+    static void release(void* s);
+    shard& local_shard();
+    info& get(u64 counter_id);
+    void unlink(shard* prev, shard* s);
+    void retire(shard* s);
+    void collect();
+    void merge(info* to, u64 ncounters);
+    void print(long mlog_params, const info* counters, u64 ncounters, bool delta);
+    void dump(u32 period);
+    void trace_flush(void* writer);
+    void trace_run(char_it file);
+
 public:
+    volatile bool tracing;
+
     enum type
     {
         time, rdtsc, count
@@ -53,6 +111,16 @@ public:
     u64 register_counter(const char* name, type t);
     void add(u64 counter_id, ttime_t time);
     void print(long mlog_params);
+    //print counters changes every period seconds
+    void start_dumps(u32 period);
+    void stop_dumps();
+    void trace(u64 counter_id, ttime_t from, ttime_t to);
+    //start tracer thread with tracing enabled (log_init does it for environment
+    //variable profiler_trace), every tracing session written to
+    //file, file.1, file.2, ...
+    void start_trace(char_cit file);
+    void stop_trace();
+    void switch_trace();
     static void set_instance(profiler* p);
     ~profiler();
 };
@@ -70,7 +138,10 @@ struct profile
     }
     ~profile()
     {
-        profiler_ptr->add(counter_id, ttime_t(get_time().value - time.value));
+        ttime_t t = get_time();
+        profiler_ptr->add(counter_id, ttime_t(t.value - time.value));
+        if(profiler_ptr->tracing) [[unlikely]]
+            profiler_ptr->trace(counter_id, time, t);
     }
     profile(const profile&) = delete;
 };
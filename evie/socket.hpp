@@ -28,6 +28,7 @@ int socket_accept(u32 port, bool local,
 int socket_accept(u32 port, const mstring& possible_client_ip,
     mstring* client_ip_ptr = nullptr, volatile bool* can_run = nullptr, char_cit name = "");
 optional<u32> socket_result(int ret, str_holder fname);
+bool check_socket(int socket, int events, int timeout_ms, str_holder log_name);
 
 struct socket_stream_op
 {
@@ -30,6 +30,7 @@ extern "C"
     extern int close(int);
     extern int system(char_cit);
     extern char_it strdup(char_cit) NE AM NN(1);
+    extern char_it strndup(char_cit, size_t) NE AM NN(1);
 
 #undef NE
 #undef NN
@@ -334,6 +334,11 @@ void on_usr_signal(int sign)
     profiler_ptr->print(mlog::critical);
 }
 
+void on_usr2_signal(int)
+{
+    profiler_ptr->switch_trace();
+}
+
 void enable_core_dump()
 {
     if(!getenv("core"))
@@ -355,6 +360,7 @@ signals_holder::signals_holder(signal_f term_signal_func, signal_f usr_signal_fu
     std::signal(SIGHUP, &on_signal);
     std::signal(SIGPIPE, &on_signal);
     std::signal(SIGUSR1, usr_signal_func ? usr_signal_func : &on_usr_signal);
+    std::signal(SIGUSR2, &on_usr2_signal);
 }
 
 signals_holder::~signals_holder()
@@ -364,5 +370,6 @@ signals_holder::~signals_holder()
     std::signal(SIGHUP, SIG_DFL);
     std::signal(SIGPIPE, SIG_DFL);
     std::signal(SIGUSR1, SIG_DFL);
+    std::signal(SIGUSR2, SIG_DFL);
 }
 
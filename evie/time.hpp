@@ -18,6 +18,49 @@ struct ttime_t
 ttime_t cur_ttime();
 ttime_t cur_ttime_seconds();
 
+//wall time from rdtsc, calibrated against CLOCK_REALTIME and resynced
+//every tsc_sync_period, cur_ttime() used without invariant tsc
+struct tsc_clock
+{
+    struct params
+    {
+        u64 tsc;
+        i64 time;
+        u64 mult; //nanoseconds per tick << 32
+    };
+    params p[2];
+    u32 cur;
+    u64 next_sync;
+    bool sync_lock;
+    u64 from_tsc; //calibration baseline
+    i64 from_time;
+};
+
+extern tsc_clock tsc_clock_v;
+ttime_t tsc_sync();
+//calibrates clock at startup (busy waits 5ms) instead of first fast_ttime() call,
+//or takes calibration of main module clock, log_init and log_set call it
+void tsc_init(tsc_clock* from = nullptr);
+
+inline ttime_t fast_ttime()
+{
+    u64 t = __builtin_ia32_rdtsc();
+    if(t >= __atomic_load_n(&tsc_clock_v.next_sync, __ATOMIC_ACQUIRE)) [[unlikely]]
+        return tsc_sync();
+    const tsc_clock::params& p = tsc_clock_v.p[__atomic_load_n(&tsc_clock_v.cur, __ATOMIC_ACQUIRE)];
+    return {p.time + i64(__extension__ (unsigned __int128)(t - p.tsc) * p.mult >> 32)};
+}
+
+//virtual time for deterministic replay, messages time used as current time,
+//flag shared with dynamic libraries by pointer
+void set_virtual_time(volatile bool* vt);
+volatile bool* get_virtual_time();
+
+inline ttime_t cur_ttime(ttime_t mtime)
+{
+    return *get_virtual_time() ? mtime : fast_ttime();
+}
+
 inline constexpr ttime_t hours(i64 s)
 {
     return {s * 3600 * ttime_t::frac};
@@ -14,6 +14,7 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <cpuid.h>
 
 void throw_system_failure(str_holder msg)
 {
@@ -337,6 +338,109 @@ ttime_t cur_ttime_seconds()
     return seconds(time(NULL));
 }
 
+tsc_clock tsc_clock_v;
+
+namespace
+{
+    static const ttime_t tsc_sync_period = milliseconds(100), tsc_calibration = milliseconds(5);
+
+    bool invariant_tsc()
+    {
+        u32 a, b, c, d;
+        if(!__get_cpuid(0x80000000, &a, &b, &c, &d) || a < 0x80000007)
+            return false;
+        __get_cpuid(0x80000007, &a, &b, &c, &d);
+        return d & (1 << 8);
+    }
+
+    //tsc and realtime read at the same moment
+    void tsc_now(u64& tsc, ttime_t& time)
+    {
+        u64 f = __builtin_ia32_rdtsc();
+        time = cur_ttime();
+        tsc = f + (__builtin_ia32_rdtsc() - f) / 2;
+    }
+}
+
+ttime_t tsc_sync()
+{
+    static const bool enabled = invariant_tsc();
+    if(!enabled || __atomic_exchange_n(&tsc_clock_v.sync_lock, true, __ATOMIC_ACQUIRE))
+        return cur_ttime();
+
+    tsc_clock& c = tsc_clock_v;
+    u64 tsc;
+    ttime_t time;
+    tsc_now(tsc, time);
+    if(!c.from_tsc)
+    {
+        c.from_tsc = tsc;
+        c.from_time = time.value;
+        do
+            tsc_now(tsc, time);
+        while(time.value < c.from_time + tsc_calibration.value);
+    }
+
+    //multiplier from the longest baseline, so it became more precise with time
+    u32 n = !c.cur;
+    c.p[n].tsc = tsc;
+    c.p[n].time = time.value;
+    u64 mult = u64((__extension__ (unsigned __int128)(time.value - c.from_time) << 32) / (tsc - c.from_tsc));
+    u64 prev = c.p[c.cur].mult;
+    if(prev && (mult > prev + prev / 1000 || mult + prev / 1000 < prev))
+    {
+        //realtime stepped (ntp, suspend), new baseline
+        mult = prev;
+        c.from_tsc = tsc;
+        c.from_time = time.value;
+    }
+    c.p[n].mult = mult;
+    u64 ticks = u64((__extension__ (unsigned __int128)tsc_sync_period.value << 32) / mult);
+    __atomic_store_n(&c.cur, n, __ATOMIC_RELEASE);
+    __atomic_store_n(&c.next_sync, tsc + ticks, __ATOMIC_RELEASE);
+    __atomic_store_n(&c.sync_lock, false, __ATOMIC_RELEASE);
+    return time;
+}
+
+void tsc_init(tsc_clock* from)
+{
+    tsc_clock& c = tsc_clock_v;
+    if(!from || from == &c)
+    {
+        if(!c.from_tsc)
+            tsc_sync();
+        return;
+    }
+    if(c.from_tsc || !from->from_tsc)
+        return;
+    while(__atomic_exchange_n(&from->sync_lock, true, __ATOMIC_ACQUIRE))
+        ;
+    c.p[0] = from->p[0];
+    c.p[1] = from->p[1];
+    c.cur = from->cur;
+    c.from_tsc = from->from_tsc;
+    c.from_time = from->from_time;
+    u64 next_sync = from->next_sync;
+    __atomic_store_n(&from->sync_lock, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&c.next_sync, next_sync, __ATOMIC_RELEASE);
+}
+
+namespace
+{
+    volatile bool virtual_time_v;
+    volatile bool* virtual_time_impl = &virtual_time_v;
+}
+
+void set_virtual_time(volatile bool* vt)
+{
+    virtual_time_impl = vt;
+}
+
+volatile bool* get_virtual_time()
+{
+    return virtual_time_impl;
+}
+
 void print_init(int argc, char_cit* argv)
 {
     mlog(mlog::no_cout) << print<' '>(argv, argv + argc);
@@ -20,6 +20,9 @@ config::config(char_cit fname)
 
     pooling = get_config_param<bool>(cs, "pooling");
     set_engine_time = get_config_param<bool>(cs, "set_engine_time");
+    profiler_period = get_config_param<u32>(cs, "profiler_period", true);
+    metrics = get_config_param<str_holder>(cs, "metrics", true);
+    trace = get_config_param<str_holder>(cs, "trace", true);
 }
 
 void config::print()
@@ -34,6 +37,8 @@ void config::print()
     for(auto v: exports)
         ml << "      " << v << "\n";
     ml << "  export_threads: " << export_threads << "\n"
-        << "  pooling: " << pooling << ", set_engine_time: " << set_engine_time << "\n";
+        << "  pooling: " << pooling << ", set_engine_time: " << set_engine_time << "\n"
+        << "  profiler_period: " << profiler_period << ", metrics: " << metrics << "\n"
+        << "  trace: " << trace << "\n";
 }
 
@@ -18,6 +18,9 @@ struct config : stack_singleton<config>
 
     bool pooling;
     bool set_engine_time;
+    u32 profiler_period;
+    mstring metrics;
+    mstring trace;
     config(char_cit fname);
     void print();
 };
@@ -5,6 +5,7 @@
 
 #include "engine.hpp"
 #include "exports.hpp"
+#include "trace.hpp"
 #include "types.hpp"
 
 #include "../evie/thread.hpp"
@@ -32,24 +33,86 @@ struct linked_node : messages
     linked_node* next;
 };
 
+//pushed and released nodes of one importer context or exporter,
+//single writer, summed by linked_list::sample()
+struct alignas(64) node_counter
+{
+    i64 pushed, released;
+    node_counter* next;
+    bool busy;
+
+    void add(i64& v)
+    {
+        atomic_store(v, v + 1);
+    }
+};
+
 class linked_list : fast_alloc<linked_node>
 {
     typedef fast_alloc<linked_node> base;
 
     linked_node root;
     linked_node* tail; //atomic
+    node_counter* counters; //atomic, grows only
+    ::mutex mutex;
+    metric depth, pushed;
     
 public:
-    linked_list() : tail(&root)
+    linked_list() : tail(&root), counters(),
+        depth("makoa_engine_nodes", metrics::gauge, "nodes in engine queue"),
+        pushed("makoa_engine_nodes_total", metrics::counter, "nodes pushed to engine queue")
+    {
+    }
+    ~linked_list()
+    {
+        while(counters)
+        {
+            node_counter* c = counters->next;
+            delete counters;
+            counters = c;
+        }
+    }
+    node_counter* acquire_counter()
+    {
+        scoped_lock lock(mutex);
+        node_counter* c = counters;
+        while(c && c->busy)
+            c = c->next;
+        if(!c)
+        {
+            c = new node_counter();
+            c->next = counters;
+            atomic_store(counters, c, __ATOMIC_RELEASE);
+        }
+        c->busy = true;
+        return c;
+    }
+    void release_counter(node_counter* c)
     {
+        scoped_lock lock(mutex);
+        c->busy = false;
     }
-    void push(linked_node* t) //push element in list, always success
+    //updates depth and pushed metrics, returns pushed nodes
+    i64 sample()
+    {
+        i64 p = 0, r = 0;
+        for(node_counter* c = atomic_load(counters, __ATOMIC_ACQUIRE); c; c = c->next)
+        {
+            p += atomic_load(c->pushed);
+            r += atomic_load(c->released);
+        }
+        depth.set(p - r);
+        pushed.set(p);
+        return p;
+    }
+    void push(linked_node* t, node_counter& c) //push element in list, always success
     {
         linked_node* expected = tail;
         while(!atomic_compare_exchange(tail, expected, t))
             expected = tail;
 
         expected->next = t;
+        c.add(c.pushed);
     }
     linked_node* next(linked_node* prev) //can return nullptr, but next time caller should used latest not nullptr value
     {
@@ -57,13 +120,14 @@ public:
             return root.next;
         return prev->next;
     }
-    void release_node(linked_node* n)
+    void release_node(linked_node* n, node_counter& c)
     {
         u32 consumers_left = atomic_sub(n->cnt, 1u);
         if(!consumers_left)
         {
             n->next = nullptr;
             this->free(n);
+            c.add(c.released);
         }
     }
     linked_node* alloc()
@@ -83,13 +147,14 @@ struct node_free
 {
     linked_node* n;
     linked_list& ll;
+    node_counter& c;
 
-    node_free(linked_node* n, linked_list& ll) : n(n), ll(ll) 
+    node_free(linked_node* n, linked_list& ll, node_counter& c) : n(n), ll(ll), c(c)
     {
     }
     void release()
     {
-        ll.release_node(n);
+        ll.release_node(n, c);
         n = nullptr;
     }
     ~node_free()
@@ -97,7 +162,7 @@ struct node_free
         try
         {
             if(n)
-                ll.release_node(n);
+                ll.release_node(n, c);
         }
         catch(exception& e)
         {
@@ -164,16 +229,20 @@ public:
         return *last_value;
     }
 
-    void on_disconnect();
+    void on_disconnect(node_counter& c);
 };
 
 struct context
 {
     actives acs;
     u32 buf_delta;
+    import_metrics* im;
+    node_counter* nc;
 
-    context() : buf_delta()
+    context(import_metrics* im, node_counter* nc) : buf_delta(), im(im), nc(nc)
     {
+        if(im)
+            im->connections.add();
     }
     void insert(u32 security_id, ttime_t time)
     {
@@ -200,7 +269,7 @@ struct context
         mlog() << "~context()";
         try
         {
-            acs.on_disconnect();
+            acs.on_disconnect(*nc);
         }
         catch(exception& e)
         {
@@ -246,9 +315,20 @@ class engine::impl : public stack_singleton<engine::impl>
         linked_list* ll;
         exporter exp;
         linked_node *prev, *ptmp;
-
-        imple(volatile bool& can_run, linked_list& ll, const mstring& eparams) :
-            can_run(can_run), ll(&ll), exp(eparams), prev(), ptmp()
+        node_counter* nc;
+        metric messages, lag, delay;
+        i64 nodes;
+        u32 idx;
+
+        imple(volatile bool& can_run, linked_list& ll, const mstring& eparams, u32 idx) :
+            can_run(can_run), ll(&ll), exp(eparams), prev(), ptmp(), nc(ll.acquire_counter()),
+            messages("makoa_export_messages_total{export=\"" + metric_label(eparams.str()) + "\"}",
+                metrics::counter, "messages proceed by exporter"),
+            lag("makoa_export_lag_nodes{export=\"" + metric_label(eparams.str()) + "\"}",
+                metrics::gauge, "engine queue nodes not proceed by exporter"),
+            delay("makoa_export_delay_ns{export=\"" + metric_label(eparams.str()) + "\"}",
+                metrics::gauge, "time from receiving of last proceed message"),
+            nodes(), idx(idx)
         {
         }
         bool proceed()
@@ -257,15 +337,23 @@ class engine::impl : public stack_singleton<engine::impl>
             ptmp = ll->next(prev);
             while(ptmp)
             {
+                trace_messages(ptmp->m, ptmp->count, trace_dequeue, idx);
                 exp.proceed(ptmp->m, ptmp->count);
+                trace_messages(ptmp->m, ptmp->count, trace_export, idx);
+                messages.add(ptmp->count);
+                ++nodes;
+                if(ptmp->count)
+                    delay.set((fast_ttime() - ptmp->m[ptmp->count - 1].t.time).value);
                 ret = true;
                 if(prev)
-                    ll->release_node(prev);
+                    ll->release_node(prev, *nc);
                 prev = ptmp;
                 if(!can_run)
                     break;
                 ptmp = ll->next(prev);
             }
+            if(ret)
+                lag.set(ll->sample() - nodes);
             return ret;
         }
         ~imple()
@@ -273,7 +361,8 @@ class engine::impl : public stack_singleton<engine::impl>
             try
             {
                 if(prev)
-                    ll->release_node(prev);
+                    ll->release_node(prev, *nc);
+                ll->release_counter(nc);
             }
             catch(exception& e)
             {
@@ -361,8 +450,8 @@ public:
     void init(const mvector<mstring>& exports, u32 export_threads)
     {
         consumers = exports.size();
-        for(const auto& e: exports)
-            ies.push_back(new imple(can_run, ll, e));
+        for(u32 i = 0; i != consumers; ++i)
+            ies.push_back(new imple(can_run, ll, exports[i], i));
 
         for(u32 i = 0; i != export_threads; ++i)
             threads.push_back({&impl::work_thread, this});
@@ -374,23 +463,30 @@ public:
         u32 count = full_size / message_size;
         u32 cur_delta = full_size % message_size;
 
+        if(ctx->im)
+        {
+            ctx->im->messages.add(count);
+            ctx->im->bytes.add(buf.size());
+        }
+
         char_cit ptr = buf.begin() - ctx->buf_delta;
         message* m = (message*)(ptr);
-
-        if(set_engine_time)
+        if(set_engine_time && !*get_virtual_time())
         {
-            ttime_t ct = cur_ttime();
+            ttime_t ct = fast_ttime();
             for(u32 i = 0; i != count; ++i)
                 m[i].t.time = ct;
         }
+        //after set_engine_time, all hops of message share the same origin
+        trace_messages(m, count, trace_import);
 
         linked_node* n = (linked_node*)(ptr - sizeof(linked_node::_));
         n->count = count;
         n->cnt = consumers + 1;
-        ll.push(n);
+        ll.push(n, *ctx->nc);
         notify();
         
-        node_free nf(n, ll);
+        node_free nf(n, ll, *ctx->nc);
 
         linked_node *e = ll.alloc();
         buf = {(char_cit)(e->m) + cur_delta, sizeof(messages::m) - cur_delta};
@@ -443,7 +539,16 @@ public:
     {
         can_exit = true;
     }
-    void push_clean(const mvector<actives::type>& secs) //when parser disconnected all OrdersBooks cleans
+    node_counter* acquire_counter()
+    {
+        return ll.acquire_counter();
+    }
+    void release_counter(node_counter* c)
+    {
+        ll.release_counter(c);
+    }
+    //when parser disconnected all OrdersBooks cleans
+    void push_clean(const mvector<actives::type>& secs, node_counter& c)
     {
         u32 count = secs.size();
         for(u32 ci = 0; ci != count;)
@@ -455,7 +560,7 @@ public:
             for(u32 i = 0; i != cur_c; ++i, ++ci)
                 n->m[i].mc = message_clean{{secs[ci].time, ttime_t()}, msg_clean, "",
                     secs[ci].security_id, 1/*source*/};
-            ll.push(n);
+            ll.push(n, c);
             notify();
         }
     }
@@ -476,10 +581,10 @@ engine::~engine()
     delete pimpl;
 }
 
-void actives::on_disconnect()
+void actives::on_disconnect(node_counter& c)
 {
     mlog() << "makoa() actives::on_disconnect";
-    engine::impl::instance().push_clean(data);
+    engine::impl::instance().push_clean(data, c);
     auto [it, ie] = be(data);
     for(; it != ie; ++it)
     {
@@ -492,15 +597,31 @@ void actives::on_disconnect()
     }
 }
 
-pair<void*, str_holder> import_context_create(void*)
+import_metrics::import_metrics(str_holder name) :
+    messages("makoa_import_messages_total{import=\"" + metric_label(name) + "\"}",
+        metrics::counter, "messages received by importer"),
+    bytes("makoa_import_bytes_total{import=\"" + metric_label(name) + "\"}",
+        metrics::counter, "bytes received by importer"),
+    connections("makoa_import_connections_total{import=\"" + metric_label(name) + "\"}",
+        metrics::counter, "importer connections and feed sessions"),
+    restarts("makoa_import_restarts_total{import=\"" + metric_label(name) + "\"}",
+        metrics::counter, "importer restarts after errors")
+{
+}
+
+pair<void*, str_holder> import_context_create(void* params)
 {
-    return {new context(), engine::impl::instance().alloc()};
+    engine::impl& e = engine::impl::instance();
+    return {new context((import_metrics*)params, e.acquire_counter()), e.alloc()};
 }
 
 void import_context_destroy(pair<void*, str_holder> ctx)
 {
-    engine::impl::instance().free(ctx.second, (context*)(ctx.first));
-    delete (context*)ctx.first;
+    context* c = (context*)(ctx.first);
+    node_counter* nc = c->nc;
+    engine::impl::instance().free(ctx.second, c);
+    delete c;
+    engine::impl::instance().release_counter(nc);
 }
 
 bool import_proceed_data(str_holder& buf, void* ctx)
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "../evie/metrics.hpp"
 #include "../evie/mstring.hpp"
 
 struct engine
@@ -17,3 +18,11 @@ struct engine
     ~engine();
 };
 
+
+//per importer metrics, passed as params to import_context_create
+struct import_metrics
+{
+    metric messages, bytes, connections, restarts;
+
+    import_metrics(str_holder name);
+};
@@ -4,6 +4,7 @@
 */
 
 #include "exports.hpp"
+#include "engine.hpp"
 #include "types.hpp"
 #include "dlfcn.hpp"
 #include "mmap.hpp"
@@ -11,6 +12,7 @@
 #include "../tyra/tyra.hpp"
 
 #include "../evie/profiler.hpp"
+#include "../evie/blog.hpp"
 #include "../evie/socket.hpp"
 #include "../evie/fmap.hpp"
 #include "../evie/mlog.hpp"
@@ -68,6 +70,7 @@ void init_exporter_params(exporter_params params)
     log_set(params.sl);
     set_can_run(params.can_run);
     efactory = params.efactory;
+    set_virtual_time(params.virtual_time);
 }
 
 hole_exporter load_exporter(const mstring& lib)
@@ -75,7 +78,7 @@ hole_exporter load_exporter(const mstring& lib)
     typedef void (create_hole)(hole_exporter* m, exporter_params params);
     auto f = lib_load<create_hole>("./lib" + lib + ".so", "create_hole");
     hole_exporter he;
-    f.second(&he, {log_get(), can_run_impl, efactory});
+    f.second(&he, {log_get(), can_run_impl, efactory, get_virtual_time()});
     efactory->dyn_exporters.push_back(move(f.first));
     return he;
 }
@@ -95,19 +98,37 @@ void log_message(void*, const message* m, u32 count)
     for(u32 i = 0; i != count; ++i, ++m)
     {
         if(m->id == msg_book)
-            mlog() << "<" << m->mb;
+        {
+            const message_book& b = m->mb;
+            BLOG("<book|{}|{}|{}|{}|{}|{}|{}|", b.id, b.security_id, b.level_id,
+                b.price, b.count, b.etime, b.time)
+        }
         else if(m->id == msg_trade)
-            mlog() << "<" << m->mt;
+        {
+            const message_trade& t = m->mt;
+            BLOG("<trade|{}|{}|{}|{}|{}|{}|{}|", t.id, t.security_id, t.direction,
+                t.price, t.count, t.etime, t.time)
+        }
         else if(m->id == msg_clean)
-            mlog() << "<" << m->mc;
+        {
+            const message_clean& c = m->mc;
+            BLOG("<clean|{}|{}|{}|{}|{}|", c.id, c.security_id, c.source, c.etime, c.time)
+        }
         else if(m->id == msg_instr)
-            mlog() << "<" << m->mi;
+        {
+            const message_instr& i = m->mi;
+            BLOG("<instr|{}|{}|{}|{}|{}|{}|{}|", i.id, i.exchange_id, i.feed_id, i.security,
+                i.security_id, i.etime, i.time)
+        }
         else if(m->id == msg_ping)
-            mlog() << "<" << m->mp;
+            BLOG("<ping|{}|{}|{}|", m->mp.id, m->mp.etime, m->mp.time)
         else if(m->id == msg_hello)
-            mlog() << "<" << m->dratuti;
+        {
+            const message_hello& h = m->dratuti;
+            BLOG("<ping|{}{}||{}|{}|", h.name, h.id, h.etime, h.time)
+        }
     }
-    mlog() << "<flush|";
+    BLOG("<flush|")
 }
 void* hole_no_init(char_cit)
 {
@@ -480,11 +501,12 @@ bool import_proceed_data(str_holder& buf, void* ctx);
 
 struct local_import
 {
+    import_metrics im;
     pair<void*, str_holder> ctx;
 
-    local_import(char_cit params)
+    local_import(char_cit) : im("local_import")
     {
-        ctx = import_context_create((void*)params);
+        ctx = import_context_create(&im);
     }
     void proceed(const message* m, u32 count)
     {
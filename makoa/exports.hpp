@@ -49,6 +49,7 @@ struct exporter_params
     simple_log* sl;
     volatile bool* can_run;
     exports_factory* efactory;
+    volatile bool* virtual_time;
 };
 
 void set_can_run(volatile bool* can_run);
@@ -29,7 +29,7 @@ struct reader
 {
     reader_state socket;
     pair<void*, str_holder> ctx;
-    time_t recv_time;
+    ttime_t recv_time;
 
     bool proceed(bool& r)
     {
@@ -47,12 +47,12 @@ struct reader
 
         ctx.second.resize(*readed);
         bool ret = import_proceed_data(ctx.second, ctx.first);
-        recv_time = time(NULL);
+        recv_time = fast_ttime();
         r = true;
         return ret;
     }
     reader(void* ctx_params, reader_state socket) : socket(socket),
-        ctx(import_context_create(ctx_params)), recv_time(time(NULL))
+        ctx(import_context_create(ctx_params)), recv_time(fast_ttime())
     {
     }
     ~reader()
@@ -220,7 +220,7 @@ void work_thread_reader(reader& r, volatile bool& can_run, i32 timeout/*in secon
 
         if(!ret)
         {
-            if(time(NULL) > r.recv_time + timeout)
+            if(fast_ttime() > r.recv_time + seconds(timeout))
                 throw str_exception("feed timeout");
 
             continue;
@@ -25,5 +25,16 @@ extern "C"
     void* files_replay_create(const char* params, volatile bool& can_run);
     void files_replay_destroy(void *v);
     u32 files_replay_read(void *v, char* buf, u32 buf_size);
+
+    //history of files merged by time without pacing, sources filled by files indexes,
+    //destroyed by files_replay_destroy
+    void* files_merge_create(const char* files, volatile bool& can_run);
+    u32 files_merge_read(void* v, char* buf, u32 buf_size, u16* sources);
+
+    //threads for building books at start of history, 1 for serial
+    void ifile_set_compact_threads(u32 threads);
+
+    //keep indexes of opened files in memory, for long living processes
+    void ifile_set_index_cache(bool enabled);
 }
 
@@ -10,9 +10,12 @@
 #include "server.hpp"
 #include "config.hpp"
 #include "exports.hpp"
+#include "trace.hpp"
 
 #include "../evie/config.hpp"
+#include "../evie/metrics.hpp"
 #include "../evie/mlog.hpp"
+#include "../evie/profiler.hpp"
 #include "../evie/signals.hpp"
 #include "../evie/string.hpp"
 #include "../evie/cond_stream.hpp"
@@ -41,6 +44,13 @@ int main(int argc, char_cit* argv)
         config cfg(argc == 1 ? "makoa_server.conf" : argv[1]);
         cfg.print();
         name = cfg.name;
+        profiler_ptr->start_dumps(cfg.profiler_period);
+        unique_ptr<metrics_server> ms;
+        if(!cfg.metrics.empty())
+            ms.reset(new metrics_server(cfg.metrics));
+        unique_ptr<trace_ring> tr;
+        if(!cfg.trace.empty())
+            tr.reset(new trace_ring(cfg.trace));
         engine en(can_run, cfg.pooling, cfg.exports, cfg.export_threads, cfg.set_engine_time);
         server sv(can_run);
         sv.run(cfg.imports);
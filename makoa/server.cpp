@@ -3,6 +3,7 @@
 */
 
 #include "server.hpp"
+#include "engine.hpp"
 #include "imports.hpp"
 
 #include "../evie/thread.hpp"
@@ -40,6 +41,7 @@ struct server::impl
             *c = char();
             hole_importer hi = create_importer(f);
             void* i = hi.init(can_run, c + 1);
+            import_metrics im(str.str());
             {
                 scoped_lock lock(mutex);
                 imports[get_thread_id()] = {hi, i};
@@ -51,7 +53,7 @@ struct server::impl
             {
                 try
                 {
-                    hi.start(i, nullptr);
+                    hi.start(i, &im);
                     if(quit_on_exit)
                         break;
                     else
@@ -60,6 +62,7 @@ struct server::impl
                 catch (exception& e)
                 {
                     mlog() << "import_thread " << str << " " << e;
+                    im.restarts.add();
                     for(int i = 0; can_run && i != 5; ++i)
                         sleep(1);
                 }
@@ -0,0 +1,77 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+*/
+
+#include "trace.hpp"
+
+#include "../evie/atomic.hpp"
+#include "../evie/mlog.hpp"
+#include "../evie/string.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+trace_ring* trace_ptr;
+
+trace_ring::trace_ring(const mstring& params)
+{
+    mvector<str_holder> p = split(params.str(), ' ');
+    if(p.empty() || p.size() > 2)
+        throw mexception(es() % "trace_ring, file_name[ capacity] required: " % params);
+    u64 capacity = p.size() == 2 ? lexical_cast<u64>(p[1]) : 1024 * 1024;
+    if(!capacity)
+        throw str_exception("trace_ring, zero capacity");
+
+    mstring fname = p[0];
+    size = sizeof(trace_header) + capacity * sizeof(trace_record);
+    int h = ::open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IWRITE | S_IREAD | S_IRGRP | S_IROTH);
+    if(h < 0)
+        throw_system_failure(es() % "trace_ring, open " % fname % " error");
+    if(ftruncate(h, size))
+    {
+        ::close(h);
+        throw_system_failure(es() % "trace_ring, ftruncate " % fname % " error");
+    }
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, h, 0);
+    ::close(h);
+    if(ptr == MAP_FAILED)
+        throw_system_failure(es() % "trace_ring, mmap " % fname % " error");
+
+    header = (trace_header*)ptr;
+    records = (trace_record*)(header + 1);
+    header->magic = trace_magic;
+    header->capacity = capacity;
+    header->count = 0;
+    trace_ptr = this;
+    mlog() << "trace_ring " << fname << " started, capacity: " << capacity;
+}
+
+trace_ring::~trace_ring()
+{
+    trace_ptr = nullptr;
+    munmap(header, size);
+}
+
+void trace_ring::add(const message* m, u32 count, trace_hop hop, u32 exporter)
+{
+    ttime_t time = fast_ttime();
+    for(u32 i = 0; i != count; ++i, ++m)
+    {
+        u32 id = trace_id(*m);
+        if(!id) [[likely]]
+            continue;
+
+        u64 c = atomic_add(header->count, u64(1)) - 1;
+        trace_record& r = records[c % header->capacity];
+        r.time = time;
+        r.origin = m->t.time;
+        r.security_id = m->id == msg_book ? m->mb.security_id : m->mt.security_id;
+        r.id = id;
+        r.hop = hop;
+        r.exporter = exporter;
+        r.reserved = 0;
+    }
+}
+
@@ -0,0 +1,86 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    sampled hop tracing, parsers mark one of trace_rate book and trade messages
+    by non zero 24 bits trace id in unused bytes (environment variable trace_rate),
+    makoa with trace config param records every hop of marked messages to
+    trace ring, mmaped file of last capacity records, utils join builds per hop
+    latencies from rings of all processes of chain, trace ids restart with every
+    parser session, so records joined by security_id, trace id and origin time
+*/
+
+#pragma once
+
+#include "messages.hpp"
+
+#include "../evie/mstring.hpp"
+
+enum trace_hop
+{
+    trace_import = 1, //import_proceed_data entry
+    trace_dequeue = 2, //exporter took node from engine queue
+    trace_export = 3 //exporter proceed node
+};
+
+struct trace_record
+{
+    ttime_t time, origin; //hop time, message time
+    u32 security_id, id;
+    u16 hop, exporter;
+    u32 reserved;
+};
+
+static_assert(sizeof(trace_record) == 32);
+
+struct trace_header
+{
+    u64 magic, capacity, count, reserved;
+};
+
+static const u64 trace_magic = 0x6563617274616b6d; //mkatrace
+static const u32 trace_id_mask = 0xffffff;
+
+inline u32 trace_id(const message& m)
+{
+    if(m.id == msg_book)
+        return m.mb.unused[0] | (u32(m.mb.unused[1]) << 8) | (u32(m.mb.unused[2]) << 16);
+    else if(m.id == msg_trade)
+        return u32(m.mt.unused_) & trace_id_mask;
+    return 0;
+}
+
+inline void set_trace_id(message_book& m, u32 id)
+{
+    m.unused[0] = id;
+    m.unused[1] = id >> 8;
+    m.unused[2] = id >> 16;
+}
+
+inline void set_trace_id(message_trade& m, u32 id)
+{
+    m.unused = 0;
+    m.unused_ = id & trace_id_mask;
+}
+
+class trace_ring
+{
+    trace_header* header;
+    trace_record* records;
+    u64 size;
+
+public:
+    //params: file_name[ capacity]
+    trace_ring(const mstring& params);
+    trace_ring(const trace_ring&) = delete;
+    ~trace_ring();
+    void add(const message* m, u32 count, trace_hop hop, u32 exporter = 0);
+};
+
+extern trace_ring* trace_ptr;
+
+inline void trace_messages(const message* m, u32 count, trace_hop hop, u32 exporter = 0)
+{
+    if(trace_ptr) [[unlikely]]
+        trace_ptr->add(m, count, hop, exporter);
+}
+
@@ -0,0 +1,256 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    block_cache, decompressed blocks of immutable recorded files (gz, gzf frames,
+    blk with footer) shared by all readers on host through files in block_cache_dir,
+    enabled by environment variable block_cache=<budget_MB>
+
+    entry name is dev_inode_mtime_size_block, entries published by rename of
+    private tmp file, touched on every hit, least recently used entries removed
+    when cache size exceeds budget
+
+    missing block claimed by O_EXCL creation of .dev_inode_mtime_size_block file,
+    claimant decompresses and puts it, other readers poll for published entry,
+    claim older than block_cache_claim_timeout treated as stale and taken over
+*/
+
+#pragma once
+
+#include "../evie/mfile.hpp"
+#include "../evie/mlog.hpp"
+#include "../evie/mstring.hpp"
+#include "../evie/sort.hpp"
+#include "../evie/string.hpp"
+#include "../evie/thread.hpp"
+#include "../evie/time.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char_cit block_cache_dir = "/dev/shm/mgame_cache/";
+static const ttime_t block_cache_claim_timeout = seconds(10);
+
+class block_cache
+{
+    u64 budget, added;
+    mutex m;
+
+    block_cache() : budget(), added()
+    {
+        char_cit b = getenv("block_cache");
+        if(b)
+            budget = lexical_cast<u64>(_str_holder(b)) * 1024 * 1024;
+        if(budget)
+        {
+            create_directories(block_cache_dir);
+            mlog() << "block_cache " << _str_holder(block_cache_dir)
+                << " enabled, budget: " << budget / (1024 * 1024) << "MB";
+        }
+    }
+    block_cache(const block_cache&) = delete;
+
+    mstring name(const mstring& key, u64 block) const
+    {
+        return _str_holder(block_cache_dir) + key + "_" + to_string(block);
+    }
+    mstring claim_name(const mstring& key, u64 block) const
+    {
+        return _str_holder(block_cache_dir) + "." + key + "_" + to_string(block);
+    }
+    //block claimed by this thread, released by put() or next get()
+    struct claim
+    {
+        mstring name;
+        ino_t ino;
+    };
+    static claim& claimed()
+    {
+        thread_local claim c;
+        return c;
+    }
+    //remove claim file if it is still ours, not taken over as stale
+    static void release()
+    {
+        claim& c = claimed();
+        if(c.name.empty())
+            return;
+        struct stat st;
+        if(!stat(c.name.c_str(), &st) && st.st_ino == c.ino)
+            unlink(c.name.c_str());
+        c.name.clear();
+    }
+    static ttime_t age(const struct stat& st)
+    {
+        return cur_ttime() - ttime_t{st.st_mtim.tv_sec * ttime_t::frac + st.st_mtim.tv_nsec};
+    }
+    template<typename type>
+    static bool read(int h, mvector<type>& data)
+    {
+        mfile f(h);
+        u64 sz = f.size();
+        if(sz % sizeof(type))
+            return false;
+        data.resize(sz / sizeof(type));
+        if(::pread(h, data.begin(), sz, 0) != ssize_t(sz))
+            return false;
+        futimens(h, nullptr);
+        return true;
+    }
+    //remove least recently used entries till cache size is less than 0.9 of budget
+    void evict()
+    {
+        DIR* d = opendir(block_cache_dir);
+        if(!d)
+            return;
+
+        struct entry
+        {
+            i64 time;
+            u64 size;
+            u32 name;
+        };
+        mvector<entry> entries;
+        mvector<mstring> names;
+        u64 size = 0;
+        while(dirent* e = readdir(d))
+        {
+            if(!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+                continue;
+            mstring n = _str_holder(block_cache_dir) + _str_holder(e->d_name);
+            struct stat st;
+            if(stat(n.c_str(), &st))
+                continue;
+            //claims and tmp files of crashed readers
+            if(e->d_name[0] == '.')
+            {
+                if(age(st) > block_cache_claim_timeout)
+                    unlink(n.c_str());
+                continue;
+            }
+            entries.push_back({st.st_mtim.tv_sec * ttime_t::frac + st.st_mtim.tv_nsec,
+                u64(st.st_size), u32(names.size())});
+            names.push_back(move(n));
+            size += st.st_size;
+        }
+        closedir(d);
+
+        if(size <= budget)
+            return;
+        sort(entries.begin(), entries.end(),
+            [](const entry& l, const entry& r) {return l.time < r.time;});
+        u64 removed = 0;
+        for(const entry& e: entries)
+        {
+            if(size <= budget / 10 * 9)
+                break;
+            if(!unlink(names[e.name].c_str()))
+            {
+                size -= e.size;
+                ++removed;
+            }
+        }
+        mlog() << "block_cache::evict() removed " << removed << " entries, cache size: "
+            << size / (1024 * 1024) << "MB";
+    }
+
+public:
+    static block_cache& instance()
+    {
+        static block_cache c;
+        return c;
+    }
+    //key of immutable file, empty if cache disabled
+    mstring key(int hfile) const
+    {
+        if(!budget)
+            return mstring();
+        struct stat st;
+        if(fstat(hfile, &st))
+            throw_system_failure("block_cache::key() fstat error");
+        return to_string(u64(st.st_dev)) + "_" + to_string(u64(st.st_ino)) + "_"
+            + to_string(st.st_mtim.tv_sec * ttime_t::frac + st.st_mtim.tv_nsec)
+            + "_" + to_string(u64(st.st_size));
+    }
+    //false if block missing, then block claimed by caller for decompression and put(),
+    //or concurrent claimant failed to publish it in time
+    template<typename type>
+    bool get(const mstring& key, u64 block, mvector<type>& data)
+    {
+        if(key.empty())
+            return false;
+        release();
+        mstring n = name(key, block), c = claim_name(key, block);
+        for(;;)
+        {
+            int h = ::open(n.c_str(), O_RDONLY);
+            if(h >= 0)
+                return read(h, data);
+            h = ::open(c.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IWRITE | S_IREAD | S_IRGRP | S_IROTH);
+            struct stat st;
+            if(h >= 0)
+            {
+                bool ok = !fstat(h, &st);
+                ::close(h);
+                if(ok)
+                    claimed() = {c, st.st_ino};
+                else
+                    unlink(c.c_str());
+                //entry could be published between checks
+                h = ::open(n.c_str(), O_RDONLY);
+                if(h < 0)
+                    return false;
+                release();
+                return read(h, data);
+            }
+            if(errno != EEXIST)
+                return false;
+            if(stat(c.c_str(), &st))
+                continue;
+            if(age(st) > block_cache_claim_timeout)
+            {
+                mlog(mlog::critical) << "block_cache::get() stale claim " << c << " removed";
+                unlink(c.c_str());
+                continue;
+            }
+            usleep(1000);
+        }
+    }
+    void put(const mstring& key, u64 block, const void* data, u64 size)
+    {
+        if(key.empty())
+            return;
+        mstring n = name(key, block);
+        mstring tmp = _str_holder(block_cache_dir) + "." + key + "_" + to_string(block)
+            + "." + to_string(getpid()) + "." + to_string(u64(gettid()));
+        int h = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IWRITE | S_IREAD | S_IRGRP | S_IROTH);
+        if(h < 0)
+        {
+            mlog(mlog::critical) << "block_cache::put() open " << tmp << " error";
+            release();
+            return;
+        }
+        bool ok = ::write(h, data, size) == ssize_t(size);
+        ::close(h);
+        if(!ok || rename(tmp.c_str(), n.c_str()))
+        {
+            mlog(mlog::critical) << "block_cache::put() " << n << " error";
+            unlink(tmp.c_str());
+            release();
+            return;
+        }
+        release();
+
+        mutex::scoped_lock lock(m);
+        added += size;
+        if(added > budget / 16)
+        {
+            added = 0;
+            evict();
+        }
+    }
+};
@@ -0,0 +1,613 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    blk, block-columnar format for recorded messages
+
+    file: block[ block...][ footer]
+    block: blk_header, u32 security_ids[nsecs] (sorted), compressed columns
+    footer: blk_index[nblocks], blk_trailer
+
+    messages inside block stable sorted by time, every column is varint stream
+    compressed by zlib, time and etime stored as deltas, price as delta
+    from the previous price of the same security, level_id as delta from price,
+    so blocks can be skipped by time range or security list without decompression.
+    footer written on close, files without footer (live or crashed writer)
+    are indexed by walking block headers
+*/
+
+#pragma once
+
+#include "block_cache.hpp"
+
+#include "../makoa/types.hpp"
+
+#include "../evie/algorithm.hpp"
+#include "../evie/mlog.hpp"
+#include "../evie/sort.hpp"
+#include "../evie/string.hpp"
+#include "../evie/vector.hpp"
+
+#include <zlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const u32 blk_magic = 0x316b6c62 /*blk1*/, blk_footer_magic = 0x666b6c62 /*blkf*/;
+static const u32 blk_max_count = 16 * 1024;
+static const ttime_t blk_max_span = seconds(1);
+
+enum blk_column
+{
+    blk_id,
+    blk_time,
+    blk_etime,
+    blk_security,
+    blk_price,
+    blk_count,
+    blk_level,
+    blk_extra,
+    blk_columns
+};
+
+struct blk_header
+{
+    u32 magic, count, nsecs, size;
+    ttime_t tf, tt;
+    u32 csize[blk_columns], usize[blk_columns];
+};
+
+struct blk_index
+{
+    u64 offset, from;
+    ttime_t tf, tt;
+    u32 count, nsecs;
+};
+
+struct blk_trailer
+{
+    u64 footer;
+    u32 nblocks, magic;
+};
+
+inline void blk_put(mvector<u8>& c, u64 v)
+{
+    while(v >= 0x80)
+    {
+        c.push_back(u8(v | 0x80));
+        v >>= 7;
+    }
+    c.push_back(u8(v));
+}
+
+inline void blk_put_signed(mvector<u8>& c, i64 v)
+{
+    blk_put(c, (u64(v) << 1) ^ u64(v >> 63));
+}
+
+inline void blk_put(mvector<u8>& c, const void* p, u32 size)
+{
+    c.insert((const u8*)p, (const u8*)p + size);
+}
+
+struct blk_cursor
+{
+    const u8 *it, *ie;
+
+    u64 get()
+    {
+        u64 v = 0;
+        for(u32 s = 0; it != ie; s += 7)
+        {
+            u8 b = *it++;
+            v |= u64(b & 0x7f) << s;
+            if(!(b & 0x80))
+                return v;
+        }
+        throw str_exception("blk_cursor::get() unexpected column end");
+    }
+    i64 get_signed()
+    {
+        u64 v = get();
+        return i64(v >> 1) ^ -i64(v & 1);
+    }
+    void get(void* p, u32 size)
+    {
+        if(u32(ie - it) < size)
+            throw str_exception("blk_cursor::get() unexpected column end");
+        memcpy(p, it, size);
+        it += size;
+    }
+};
+
+struct blk_encoder
+{
+    mvector<u8> columns[blk_columns];
+    mvector<u32> secs, idx;
+    mvector<i64> prices;
+    mvector<char> out;
+
+    u32 sec_idx(u32 security_id) const
+    {
+        return lower_bound(secs.begin(), secs.end(), security_id) - secs.begin();
+    }
+    void prepare(const message* from, const message* to)
+    {
+        secs.clear();
+        idx.resize(to - from);
+        bool sorted = true;
+        for(u32 i = 0; i != idx.size(); ++i)
+        {
+            idx[i] = i;
+            const message& m = from[i];
+            if(m.id == msg_book)
+                secs.push_back(m.mb.security_id);
+            else if(m.id == msg_trade)
+                secs.push_back(m.mt.security_id);
+            else if(m.id == msg_clean)
+                secs.push_back(m.mc.security_id);
+            else if(m.id == msg_instr)
+                secs.push_back(m.mi.security_id);
+            if(i && m.t.time < from[i - 1].t.time)
+                sorted = false;
+        }
+        sort(secs.begin(), secs.end());
+        u32 sz = 0;
+        for(u32 s: secs)
+            if(!sz || secs[sz - 1] != s)
+                secs[sz++] = s;
+        secs.resize(sz);
+        prices.resize(secs.size());
+        fill(prices.begin(), prices.end(), i64());
+
+        if(!sorted)
+            sort(idx.begin(), idx.end(), [from](u32 l, u32 r)
+                {
+                    ttime_t tl = from[l].t.time, tr = from[r].t.time;
+                    return tl < tr || (tl == tr && l < r);
+                });
+    }
+    void put_price(u32 si, const price_t& price, i64 level_id, bool level)
+    {
+        i64& p = prices[si];
+        blk_put_signed(columns[blk_price], price.value - p);
+        if(price.value)
+            p = price.value;
+        if(level)
+            blk_put_signed(columns[blk_level], level_id - p);
+    }
+    str_holder encode(const message* from, const message* to)
+    {
+        ASSERT(from != to);
+        prepare(from, to);
+        for(mvector<u8>& c: columns)
+            c.clear();
+
+        blk_header h = blk_header();
+        h.magic = blk_magic;
+        h.count = to - from;
+        h.nsecs = secs.size();
+        h.tf = from[idx[0]].t.time;
+        h.tt = from[idx.back()].t.time;
+
+        i64 time = h.tf.value, etime = 0;
+        for(u32 i: idx)
+        {
+            const message& m = from[i];
+            u8 id = m.id.id;
+            columns[blk_id].push_back(id);
+            blk_put_signed(columns[blk_time], m.t.time.value - time);
+            blk_put_signed(columns[blk_etime], m.t.etime.value - etime);
+            time = m.t.time.value;
+            etime = m.t.etime.value;
+
+            mvector<u8>& extra = columns[blk_extra];
+            if(id == msg_book)
+            {
+                const message_book& mb = m.mb;
+                u32 si = sec_idx(mb.security_id);
+                blk_put(columns[blk_security], si);
+                put_price(si, mb.price, mb.level_id, true);
+                blk_put_signed(columns[blk_count], mb.count.value);
+                u32 unused = 0;
+                memcpy(&unused, mb.unused, sizeof(mb.unused));
+                blk_put(extra, unused);
+            }
+            else if(id == msg_trade)
+            {
+                const message_trade& mt = m.mt;
+                u32 si = sec_idx(mt.security_id);
+                blk_put(columns[blk_security], si);
+                put_price(si, mt.price, 0, false);
+                blk_put_signed(columns[blk_count], mt.count.value);
+                blk_put(extra, mt.direction);
+                blk_put(extra, mt.unused);
+                blk_put_signed(extra, mt.unused_);
+            }
+            else if(id == msg_clean)
+            {
+                blk_put(columns[blk_security], sec_idx(m.mc.security_id));
+                blk_put(extra, m.mc.source);
+            }
+            else if(id == msg_instr)
+            {
+                const message_instr& mi = m.mi;
+                blk_put(columns[blk_security], sec_idx(mi.security_id));
+                blk_put(extra, mi.exchange_id, (char_cit)&mi.security_id - mi.exchange_id);
+            }
+            else
+                blk_put(extra, m.mp.unused, message_bsize);
+        }
+
+        u64 size = sizeof(blk_header) + secs.size() * sizeof(u32);
+        for(const mvector<u8>& c: columns)
+            size += compressBound(c.size());
+        out.resize(size);
+
+        char_it it = out.begin() + sizeof(blk_header);
+        memcpy(it, secs.begin(), secs.size() * sizeof(u32));
+        it += secs.size() * sizeof(u32);
+        for(u32 c = 0; c != blk_columns; ++c)
+        {
+            const mvector<u8>& col = columns[c];
+            h.usize[c] = col.size();
+            if(col.empty())
+                continue;
+            uLongf sz = out.end() - it;
+            if(compress2((Bytef*)it, &sz, col.begin(), col.size(), Z_BEST_SPEED) != Z_OK)
+                throw str_exception("blk_encoder::encode() compress error");
+            h.csize[c] = sz;
+            it += sz;
+        }
+        h.size = it - out.begin();
+        memcpy(out.begin(), &h, sizeof(h));
+        return str_holder(out.begin(), h.size);
+    }
+};
+
+struct blk_decoder
+{
+    mvector<u8> columns[blk_columns];
+    mvector<i64> prices;
+
+    void decode(char_cit block, mvector<message>& ret)
+    {
+        blk_header h;
+        memcpy(&h, block, sizeof(h));
+        if(h.magic != blk_magic)
+            throw str_exception("blk_decoder::decode() bad block magic");
+
+        const u32* secs = (const u32*)(block + sizeof(blk_header));
+        char_cit it = (char_cit)(secs + h.nsecs);
+        blk_cursor c[blk_columns];
+        for(u32 i = 0; i != blk_columns; ++i)
+        {
+            mvector<u8>& col = columns[i];
+            col.resize(h.usize[i]);
+            if(h.usize[i])
+            {
+                uLongf sz = h.usize[i];
+                if(uncompress(col.begin(), &sz, (const Bytef*)it, h.csize[i]) != Z_OK
+                    || sz != h.usize[i])
+                    throw str_exception("blk_decoder::decode() uncompress error");
+            }
+            it += h.csize[i];
+            c[i] = {col.begin(), col.end()};
+        }
+
+        prices.resize(h.nsecs);
+        fill(prices.begin(), prices.end(), i64());
+
+        auto security = [&]()
+        {
+            u64 si = c[blk_security].get();
+            if(si >= h.nsecs)
+                throw str_exception("blk_decoder::decode() bad security index");
+            return si;
+        };
+        auto price = [&](u64 si)
+        {
+            i64& p = prices[si];
+            i64 v = p + c[blk_price].get_signed();
+            if(v)
+                p = v;
+            return price_t{v};
+        };
+
+        u64 off = ret.size();
+        ret.resize(off + h.count);
+        message* m = ret.begin() + off;
+        i64 time = h.tf.value, etime = 0;
+        blk_cursor& extra = c[blk_extra];
+        for(u32 i = 0; i != h.count; ++i, ++m)
+        {
+            memset((void*)m, 0, sizeof(message));
+            if(c[blk_id].it == c[blk_id].ie)
+                throw str_exception("blk_decoder::decode() unexpected id column end");
+            u8 id = *c[blk_id].it++;
+            time += c[blk_time].get_signed();
+            etime += c[blk_etime].get_signed();
+            m->t.time.value = time;
+            m->t.etime.value = etime;
+            m->id.id = id;
+
+            if(id == msg_book)
+            {
+                message_book& mb = m->mb;
+                u64 si = security();
+                mb.security_id = secs[si];
+                mb.price = price(si);
+                mb.count.value = c[blk_count].get_signed();
+                mb.level_id = prices[si] + c[blk_level].get_signed();
+                u32 unused = extra.get();
+                memcpy(mb.unused, &unused, sizeof(mb.unused));
+            }
+            else if(id == msg_trade)
+            {
+                message_trade& mt = m->mt;
+                u64 si = security();
+                mt.security_id = secs[si];
+                mt.price = price(si);
+                mt.count.value = c[blk_count].get_signed();
+                mt.direction = extra.get();
+                mt.unused = extra.get();
+                mt.unused_ = extra.get_signed();
+            }
+            else if(id == msg_clean)
+            {
+                m->mc.security_id = secs[security()];
+                m->mc.source = extra.get();
+            }
+            else if(id == msg_instr)
+            {
+                message_instr& mi = m->mi;
+                mi.security_id = secs[security()];
+                extra.get(mi.exchange_id, (char_cit)&mi.security_id - mi.exchange_id);
+            }
+            else
+                extra.get(m->mp.unused, message_bsize);
+        }
+    }
+};
+
+class blk_reader
+{
+    int hfile;
+    u64 end, pos, messages;
+    bool footer;
+    i64 cur;
+
+    blk_decoder dec;
+    mvector<char> raw;
+    mvector<message> data;
+    //only files with footer are immutable and cached
+    mstring ckey;
+
+    void pread(void* p, u64 size, u64 off) const
+    {
+        if(::pread(hfile, p, size, off) != ssize_t(size))
+            throw_system_failure(es() % "blk_reader::pread() error, size: " % size % ", off: " % off);
+    }
+
+public:
+    mvector<blk_index> blocks;
+
+    //check first bytes of file for blk magic
+    static bool is_blk(int hfile)
+    {
+        u32 magic = 0;
+        return ::pread(hfile, &magic, sizeof(magic), 0) == sizeof(magic) && magic == blk_magic;
+    }
+    blk_reader(int hfile) : hfile(hfile), end(), pos(), messages(), footer(), cur(-1)
+    {
+        struct stat st;
+        if(fstat(hfile, &st))
+            throw_system_failure("blk_reader() fstat error");
+        u64 fsize = st.st_size;
+
+        blk_trailer t = blk_trailer();
+        if(fsize >= sizeof(blk_header) + sizeof(blk_trailer))
+            pread(&t, sizeof(t), fsize - sizeof(t));
+        if(t.magic == blk_footer_magic && t.footer + t.nblocks * sizeof(blk_index)
+            + sizeof(blk_trailer) == fsize)
+        {
+            blocks.resize(t.nblocks);
+            pread(blocks.begin(), t.nblocks * sizeof(blk_index), t.footer);
+            if(!blocks.empty())
+                messages = blocks.back().from + blocks.back().count;
+            end = t.footer;
+            footer = true;
+            ckey = block_cache::instance().key(hfile);
+        }
+        else
+            refresh();
+    }
+    //index blocks appended since last call, for files without footer
+    bool refresh()
+    {
+        if(footer)
+            return false;
+
+        struct stat st;
+        if(fstat(hfile, &st))
+            throw_system_failure("blk_reader::refresh() fstat error");
+        u64 fsize = st.st_size, sz = blocks.size();
+
+        blk_header h;
+        while(end + sizeof(blk_header) <= fsize)
+        {
+            pread(&h, sizeof(h), end);
+            if(h.magic != blk_magic)
+                throw mexception(es() % "blk_reader::refresh() bad block magic, off: " % end);
+            if(end + h.size > fsize)
+                break;
+            blocks.push_back({end, messages, h.tf, h.tt, h.count, h.nsecs});
+            messages += h.count;
+            end += h.size;
+        }
+        return sz != blocks.size();
+    }
+    //end of last complete block, appending writers truncate file here
+    u64 data_end() const
+    {
+        return end;
+    }
+    u64 size() const
+    {
+        return messages * message_size;
+    }
+    void seekg(u64 p)
+    {
+        if(p > size())
+            throw mexception(es() % "blk_reader::seekg(), size " % size() % ", pos " % p);
+        pos = p;
+    }
+    void seek_cur(i64 p)
+    {
+        seekg(pos + p);
+    }
+    u32 find_block(u64 msg) const
+    {
+        return (upper_bound(blocks.begin(), blocks.end(), msg,
+            [](u64 m, const blk_index& b) {return m < b.from;}) - blocks.begin()) - 1;
+    }
+    const mvector<message>& block(u32 i)
+    {
+        if(cur != i)
+        {
+            const blk_index& b = blocks[i];
+            block_cache& bc = block_cache::instance();
+            if(!bc.get(ckey, i, data) || data.size() != b.count)
+            {
+                u64 sz = (i + 1 == blocks.size() ? end : blocks[i + 1].offset) - b.offset;
+                raw.resize(sz);
+                pread(raw.begin(), sz, b.offset);
+                data.clear();
+                dec.decode(raw.begin(), data);
+                if(data.size() != b.count)
+                    throw mexception(es() % "blk_reader::block() bad messages count, off: " % b.offset);
+                bc.put(ckey, i, data.begin(), data.size() * message_size);
+            }
+            cur = i;
+        }
+        return data;
+    }
+    void securities(u32 i, mvector<u32>& secs) const
+    {
+        const blk_index& b = blocks[i];
+        secs.resize(b.nsecs);
+        pread(secs.begin(), b.nsecs * sizeof(u32), b.offset + sizeof(blk_header));
+    }
+    u64 read(char_it ptr, u64 sz)
+    {
+        if(pos == size())
+            refresh();
+
+        u64 ret = 0;
+        sz = min(sz, size() - pos);
+        while(ret != sz)
+        {
+            u64 msg = pos / message_size;
+            u32 i = find_block(msg);
+            const mvector<message>& d = block(i);
+            u64 off = pos - blocks[i].from * message_size;
+            u64 r = min<u64>(sz - ret, d.size() * message_size - off);
+            memcpy(ptr + ret, (char_cit)d.begin() + off, r);
+            ret += r;
+            pos += r;
+        }
+        return ret;
+    }
+    //narrow [first, last) messages range that contains lower_bound for time t
+    void narrow(ttime_t t, i64& first, i64& last) const
+    {
+        auto it = lower_bound(blocks.begin(), blocks.end(), t,
+            [](const blk_index& b, ttime_t t) {return b.tt < t;});
+        if(it == blocks.end())
+            first = last = max<i64>(first, min<i64>(last, messages));
+        else
+        {
+            first = max<i64>(first, it->from);
+            last = max<i64>(first, min<i64>(last, it->from + it->count));
+        }
+    }
+    //call f(const message*, const message*) for blocks crossed [tf, tt] and containing any of secs
+    template<typename func>
+    void select(ttime_t tf, ttime_t tt, const mvector<u32>& secs, func&& f)
+    {
+        mvector<u32> bs;
+        for(u32 i = 0; i != blocks.size(); ++i)
+        {
+            const blk_index& b = blocks[i];
+            if(b.tt < tf || b.tf > tt)
+                continue;
+            if(!secs.empty())
+            {
+                securities(i, bs);
+                bool found = false;
+                for(u32 s: secs)
+                {
+                    auto it = lower_bound(bs.begin(), bs.end(), s);
+                    if(it != bs.end() && *it == s)
+                    {
+                        found = true;
+                        break;
+                    }
+                }
+                if(!found)
+                    continue;
+            }
+            const mvector<message>& d = block(i);
+            f(d.begin(), d.end());
+        }
+    }
+};
+
+struct blk_writer
+{
+    blk_encoder enc;
+    mvector<message> buf;
+    mvector<blk_index> index;
+    u64 offset, messages;
+    mvector<char> out;
+
+    blk_writer() : offset(), messages()
+    {
+    }
+    //continue existing file, drop footer and partially written block
+    void append(int hfile, str_holder fname)
+    {
+        blk_reader r(hfile);
+        index = r.blocks;
+        offset = r.data_end();
+        messages = r.size() / message_size;
+        if(ftruncate(hfile, offset))
+            throw_system_failure(es() % "blk_writer::append() ftruncate error for " % fname);
+        mlog() << "blk_writer::append() " << fname << ", blocks: " << index.size()
+            << ", messages: " << messages;
+    }
+    //returns true when block ready for flush()
+    bool add(const message& m)
+    {
+        buf.push_back(m);
+        return buf.size() == blk_max_count || m.t.time - buf[0].t.time >= blk_max_span;
+    }
+    str_holder flush()
+    {
+        if(buf.empty())
+            return str_holder();
+        str_holder b = enc.encode(buf.begin(), buf.end());
+        const blk_header& h = *(const blk_header*)b.begin();
+        index.push_back({offset, messages, h.tf, h.tt, h.count, h.nsecs});
+        offset += b.size();
+        messages += buf.size();
+        buf.clear();
+        return b;
+    }
+    str_holder footer()
+    {
+        blk_trailer t = {offset, u32(index.size()), blk_footer_magic};
+        out.resize(index.size() * sizeof(blk_index) + sizeof(t));
+        memcpy(out.begin(), index.begin(), index.size() * sizeof(blk_index));
+        memcpy(out.end() - sizeof(t), &t, sizeof(t));
+        return str_holder(out.begin(), out.size());
+    }
+};
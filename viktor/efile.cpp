@@ -1,17 +1,47 @@
 /*
     author: Ilya Andronov <sni4ok@yandex.ru>
 
-    export = file file_type open_mode file_name
+    export = file file_type open_mode file_name[ rotate_size[ rotate_period[ snapshot_period]]]
 
-    file_type: bin, csv
+    file_type: bin, csv, blk
     open_mode: truncate, append, rename_new
+    rotate_size: megabytes, rotate file when its size reached, 0 for no rotation
+    rotate_period: seconds, rotate file on period boundaries of messages time
+    snapshot_period: seconds, write live books snapshot on period boundaries
+        of messages time and at start of every file (bin and blk only)
+
+    blk is block-columnar compressed format (see blocks.hpp),
+    blocks flushed every blk_max_count messages or blk_max_span of time
+
+    rename_new and rotation rename file to file_name_<seconds>, bin and csv files
+    then compressed to seekable framed gzip (see gzframes.hpp) by background thread
+    and published by rename, so export thread never waits for compression
+
+    bin files recorded with sidecar index file_name.idx (see index.hpp)
+
+    export thread only fills buffers, writer thread writes them to disk
+    (triple buffering, file space preallocated by fallocate), partially filled
+    buffer handed off every flush_period of messages time for live readers,
+    and its tail written by writer thread when no handoff came for flush_period
 */
 
+#include "blocks.hpp"
+#include "gzframes.hpp"
+#include "index.hpp"
+
 #include "../makoa/exports.hpp"
 #include "../makoa/types.hpp"
+#include "../evie/atomic.hpp"
 #include "../evie/mlog.hpp"
 #include "../evie/profiler.hpp"
 #include "../evie/string.hpp"
+#include "../evie/mfile.hpp"
+#include "../evie/queue.hpp"
+#include "../evie/thread.hpp"
+#include "../evie/mstring.hpp"
+
+#include <map>
+#include <unordered_map>
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -24,25 +54,418 @@
 namespace
 {
 
+static const u32 compress_threads = 4;
+
+struct compressor
+{
+    mutex m;
+    condition cv;
+    queue<mstring> files;
+    bool bin, can_run;
+    jthread thrd;
+
+    //bin: files are bin messages, csv otherwise
+    compressor(bool bin) : bin(bin), can_run(true)
+    {
+        thrd = jthread(&compressor::work_thread, this);
+    }
+    void push(const mstring& fname)
+    {
+        mutex::scoped_lock lock(m);
+        files.push_back(fname);
+        cv.notify_one();
+    }
+    void compress(const mstring& fname)
+    {
+        char_cit it = fname.end();
+        while(it != fname.begin() && *(it - 1) != '/')
+            --it;
+        mstring gz = fname + ".gz", tmp = mstring(fname.begin(), it) + "." + mstring(it, fname.end()) + ".gz.tmp";
+        try
+        {
+            ttime_t t = cur_ttime();
+            gzf_compress(fname.c_str(), tmp.c_str(), bin, compress_threads);
+            rename_file(tmp.c_str(), gz.c_str());
+            remove_file(fname.c_str());
+            mstring idx = fname + ".idx";
+            if(is_file_exist(idx.c_str()))
+                rename_file(idx.c_str(), (gz + ".idx").c_str());
+            mlog(mlog::critical) << "file " << fname << " compressed to " << gz
+                << ", time: " << print_t{cur_ttime() - t};
+        }
+        catch(exception& e)
+        {
+            mlog(mlog::critical) << "file " << fname << " compression fail, " << e;
+            if(is_file_exist(tmp.c_str()))
+                remove_file(tmp.c_str());
+        }
+    }
+    void work_thread()
+    {
+        for(;;)
+        {
+            mstring fname;
+            {
+                mutex::scoped_lock lock(m);
+                while(files.empty() && can_run)
+                    cv.wait(lock);
+                if(files.empty())
+                    return;
+                fname = files.front();
+                files.pop_front();
+            }
+            compress(fname);
+        }
+    }
+    ~compressor()
+    {
+        {
+            mutex::scoped_lock lock(m);
+            can_run = false;
+            if(!files.empty())
+                mlog(mlog::critical) << "~compressor() waiting for " << files.size() << " files";
+            cv.notify_one();
+        }
+        thrd.join();
+    }
+};
+
+static const ttime_t flush_period = milliseconds(100);
+
+class writer
+{
+    static const u32 buffers = 3;
+    static const u64 prealloc_size = 64 * 1024 * 1024;
+
+    const u32 buf_size;
+    mvector<char> bufs[buffers];
+    u32 sizes[buffers], flushed; //flushed bytes of current buffer written on idle
+    u64 filled, written;
+
+    mutex m;
+    condition cv;
+    bool can_run, prealloc, busy;
+    mstring error;
+    int hfile;
+    u64 fsize, allocated;
+    jthread thrd;
+
+    void write_impl(char_cit buf, u32 count)
+    {
+        MPROFILE("efile::writer")
+        if(prealloc && fsize + count > allocated)
+        {
+            if(fallocate(hfile, FALLOC_FL_KEEP_SIZE, fsize, prealloc_size))
+            {
+                prealloc = false;
+                mlog(mlog::critical) << "efile::writer fallocate() error, "
+                    << _str_holder(strerror(errno)) << ", preallocation disabled";
+            }
+            else
+                allocated = fsize + prealloc_size;
+        }
+        if(::write(hfile, buf, count) != ssize_t(count))
+            throw_system_failure("efile::writer writing error");
+        fsize += count;
+    }
+    void work_thread()
+    {
+        for(;;)
+        {
+            u32 i, to;
+            bool partial = false;
+            {
+                mutex::scoped_lock lock(m);
+                if(written == filled && can_run)
+                    cv.timed_uwait(lock, flush_period.value / 1000);
+                if(written == filled)
+                {
+                    if(!can_run)
+                        return;
+                    i = filled % buffers;
+                    to = atomic_load(sizes[i], __ATOMIC_ACQUIRE);
+                    if(to == flushed)
+                        continue;
+                    partial = busy = true;
+                }
+                else
+                {
+                    i = written % buffers;
+                    to = sizes[i];
+                }
+            }
+            try
+            {
+                write_impl(bufs[i].begin() + flushed, to - flushed);
+            }
+            catch(exception& e)
+            {
+                mutex::scoped_lock lock(m);
+                error = _str_holder(e.what());
+            }
+            mutex::scoped_lock lock(m);
+            if(partial)
+            {
+                flushed = to;
+                busy = false;
+            }
+            else
+            {
+                flushed = 0;
+                ++written;
+            }
+            cv.notify_all();
+        }
+    }
+
+public:
+    writer(u32 buf_size) : buf_size(buf_size), sizes(), flushed(), filled(), written(), can_run(true),
+        prealloc(true), busy(), hfile(), fsize(), allocated()
+    {
+        for(mvector<char>& b: bufs)
+            b.resize(buf_size);
+        thrd = jthread(&writer::work_thread, this);
+    }
+    //only when writer is idle, after sync()
+    void set_file(int h, u64 size)
+    {
+        hfile = h;
+        fsize = size;
+        allocated = 0;
+    }
+    void write(char_cit buf, u64 count)
+    {
+        while(count)
+        {
+            u32 i = filled % buffers;
+            u32 r = min<u64>(count, buf_size - sizes[i]);
+            memcpy(bufs[i].begin() + sizes[i], buf, r);
+            atomic_store(sizes[i], sizes[i] + r, __ATOMIC_RELEASE);
+            buf += r;
+            count -= r;
+            if(sizes[i] == buf_size)
+                handoff();
+        }
+    }
+    void handoff()
+    {
+        if(!sizes[filled % buffers])
+            return;
+
+        mutex::scoped_lock lock(m);
+        if(!error.empty())
+            throw mexception(es() % "efile::writer error: " % error);
+        ++filled;
+        cv.notify_all();
+        if(filled - written == buffers)
+        {
+            MPROFILE("efile::handoff_wait")
+            while(filled - written == buffers)
+                cv.wait(lock);
+        }
+        sizes[filled % buffers] = 0;
+    }
+    void sync()
+    {
+        handoff();
+        mutex::scoped_lock lock(m);
+        while(written != filled || busy)
+            cv.wait(lock);
+        if(!error.empty())
+            throw mexception(es() % "efile::writer error: " % error);
+    }
+    //sync and release preallocated space
+    void close()
+    {
+        sync();
+        if(allocated > fsize && ftruncate(hfile, fsize))
+            throw_system_failure("efile::writer ftruncate error");
+        allocated = 0;
+    }
+    ~writer()
+    {
+        {
+            mutex::scoped_lock lock(m);
+            can_run = false;
+            cv.notify_all();
+        }
+        thrd.join();
+    }
+};
+
+
 struct efile
 {
     buf_stream_fixed<1024 * 1024> bs;
     bool bin = false;
+    unique_ptr<blk_writer> blk;
+    unique_ptr<compressor> zip;
+    writer w;
+    unique_ptr<writer> wi;
     mstring fname;
-    int hfile;
+    int hfile, hidx;
+    u64 fsize, rotate_size, rotate_skip;
+    ttime_t rotate_period, rotate_time, flush_time;
+
+    //live books for snapshots
+    struct book : std::unordered_map<i64/*level_id*/, message_book>
+    {
+        message_instr mi = message_instr();
+    };
+    std::map<u32/*security_id*/, book> books;
+    ttime_t snapshot_period, snapshot_time;
+    mvector<message> snap;
+
+    void open_file(int fp)
+    {
+        if(!!blk)
+            fp = (fp & ~O_WRONLY) | O_RDWR;
+
+        hfile = ::open(fname.c_str(), fp, S_IWRITE | S_IREAD | S_IRGRP | S_IWGRP);
+        if(hfile < 0)
+            throw_system_failure(es() % "open file " % fname % " error");
+
+        struct stat st;
+        if(fstat(hfile, &st))
+            throw_system_failure("fstat() error");
+        fsize = st.st_size;
+        w.set_file(hfile, fsize);
 
-    efile(const mstring& params)
+        if(bin)
+        {
+            mstring idx = fname + ".idx";
+            if(!fsize || is_file_exist(idx.c_str()))
+            {
+                hidx = ::open(idx.c_str(), O_WRONLY | O_CREAT | O_APPEND | (fsize ? 0 : O_TRUNC),
+                    S_IWRITE | S_IREAD | S_IRGRP | S_IWGRP);
+                if(hidx < 0)
+                    throw_system_failure(es() % "open file " % idx % " error");
+                if(!wi)
+                    wi.reset(new writer(64 * 1024));
+                wi->set_file(hidx, file_size(idx.c_str()));
+            }
+            else
+                mlog(mlog::critical) << "file " << fname << " recorded without index";
+        }
+    }
+    void close_file()
+    {
+        w.close();
+        ::close(hfile);
+        if(hidx)
+        {
+            wi->close();
+            ::close(hidx);
+            hidx = 0;
+        }
+    }
+    //false if file not renamed and should be continued
+    bool backup(ttime_t time)
+    {
+        u64 secs = to_seconds(time);
+        mstring backup = fname + "_" + to_string(secs);
+        while(is_file_exist(backup.c_str()) || is_file_exist((backup + ".gz").c_str()))
+            backup = fname + "_" + to_string(++secs);
+
+        int r = rename(fname.c_str(), backup.c_str());
+        if(r)
+        {
+            mlog(mlog::critical) << "rename file from " << fname << ", to " << backup
+                << ", error: " << r << ", "
+                << _str_holder(errno ? strerror(errno) : "");
+            return false;
+        }
+        mlog(mlog::critical) << "file renamed from " << fname << ", to " << backup;
+
+        mstring idx = fname + ".idx";
+        if(is_file_exist(idx.c_str()))
+            rename_file(idx.c_str(), (backup + ".idx").c_str());
+
+        if(!!blk)
+            mlog(mlog::critical) << "file " << backup << " blk format, compression skipped";
+        else
+        {
+            if(!zip)
+                zip.reset(new compressor(bin));
+            zip->push(backup);
+        }
+        return true;
+    }
+    void rotate(ttime_t time)
+    {
+        if(!!blk)
+        {
+            write(blk->flush());
+            write(blk->footer());
+            blk.reset(new blk_writer);
+        }
+        close_file();
+        if(backup(time))
+        {
+            open_file(O_WRONLY | O_CREAT | O_APPEND | O_TRUNC);
+            snapshot_time = ttime_t();
+            rotate_skip = 0;
+        }
+        else
+        {
+            open_file(O_WRONLY | O_CREAT | O_APPEND);
+            if(!!blk)
+            {
+                blk->append(hfile, fname.str());
+                fsize = blk->offset;
+                w.set_file(hfile, fsize);
+            }
+            rotate_skip = fsize;
+        }
+    }
+    static ttime_t next_period(ttime_t time, ttime_t period)
+    {
+        return ttime_t{(time.value / period.value + 1) * period.value};
+    }
+    ttime_t next_rotate(ttime_t time) const
+    {
+        return next_period(time, rotate_period);
+    }
+    void check_rotate(ttime_t time)
+    {
+        if(!!rotate_period && !rotate_time)
+            rotate_time = next_rotate(time);
+
+        bool by_time = !!rotate_time && time >= rotate_time;
+        if(by_time || (rotate_size && fsize >= rotate_skip + rotate_size))
+        {
+            rotate(by_time ? rotate_time : time);
+            if(!!rotate_period)
+                rotate_time = next_rotate(time);
+        }
+    }
+
+    efile(const mstring& params) : w(1024 * 1024), hfile(), hidx(), fsize(), rotate_size(), rotate_skip(),
+        rotate_period(), rotate_time(), flush_time(), snapshot_period(), snapshot_time()
     {
         mvector<str_holder> p = split(params.str(), ' ');
-        if(p.size() != 3)
+        if(p.size() < 3 || p.size() > 6)
             throw mexception(es() %
-"efile() \"file (bin,csv) (truncate,append,rename_new) file_name\", params: " % params);
+"efile() \"file (bin,csv,blk) (truncate,append,rename_new) file_name[ rotate_size[ rotate_period[ snapshot_period]]]\", params: " % params);
 
         if(p[0] == "bin")
             bin = true;
+        else if(p[0] == "blk")
+            blk.reset(new blk_writer);
         else if(p[0] != "csv")
             throw mexception(es() % "efile() bad file_type: " % params);
 
+        if(p.size() > 3)
+            rotate_size = lexical_cast<u64>(p[3]) * 1024 * 1024;
+        if(p.size() > 4)
+            rotate_period = seconds(lexical_cast<u32>(p[4]));
+        if(p.size() > 5)
+        {
+            snapshot_period = seconds(lexical_cast<u32>(p[5]));
+            if(!!snapshot_period && !bin && !blk)
+                throw mexception(es() % "efile() snapshots not supported for csv: " % params);
+        }
+
         fname = move(p[2]);
         int fp = O_WRONLY | O_CREAT | O_APPEND;
         if(p[1] == "truncate")
@@ -53,53 +476,32 @@ struct efile
         else if(p[1] == "rename_new")
         {
             u64 fsz = 0;
-            int hfile = open(fname.c_str(), O_RDONLY);
-            if(hfile > 0)
-            {
-                struct stat st;
-                if(fstat(hfile, &st))
-                    throw_system_failure("fstat() error");
-                fsz = st.st_size;
-                close(hfile);
-            }
+            bool exist = is_file_exist(fname.c_str(), &fsz);
             if(fsz)
             {
-                mstring backup = fname + "_" + to_string(to_seconds(cur_ttime_seconds()));
-                int r = rename(fname.c_str(), backup.c_str());
-                if(r)
-                    mlog(mlog::critical) << "rename file from " << fname << ", to " << backup
-                        << ", error: " << r << ", "
-                        << _str_holder(errno ? strerror(errno) : "");
-                else
-                    mlog(mlog::critical) << "file renamed from " << fname << ", to " << backup;
-
-                if(fsz % message_size)
-                {
-                    mlog(mlog::critical) << "file " << backup << " bad size: " << fsz << ", gzip skipped";
-                }
-                else
-                {
-                    mstring gzip = "gzip " + backup;
-                    r = system(gzip.c_str());
-                    mlog(mlog::critical) << gzip
-                        << (r ? _str_holder(" fail") : _str_holder(" success"));
-                }
+                if(!blk && fsz % message_size)
+                    mlog(mlog::critical) << "file " << fname << " bad size: " << fsz;
+                backup(cur_ttime_seconds());
             }
-            if(fsz || !hfile)
+            if(fsz || !exist)
                 fp |= O_EXCL;
         }
         else
             throw mexception(es() % "efile() bad open_mode: " % params);
 
-        hfile = ::open(fname.c_str(), fp, S_IWRITE | S_IREAD | S_IRGRP | S_IWGRP);
-        if(hfile < 0)
-            throw_system_failure(es() % "open file " % fname % " error");
+        open_file(fp);
+
+        if(!!blk && p[1] == "append")
+        {
+            blk->append(hfile, fname.str());
+            fsize = blk->offset;
+            w.set_file(hfile, fsize);
+        }
     }
     void write(char_cit buf, u32 count)
     {
-        MPROFILE("efaile::write")
-        if(::write(hfile, buf, count) != ssize_t(count))
-            throw_system_failure(es() % "efile " % fname % " writing error");
+        w.write(buf, count);
+        fsize += count;
     }
     void flush()
     {
@@ -141,16 +543,155 @@ struct efile
         }
         flush();
     }
-    void proceed(const message* m, u32 count)
+    void write(str_holder b)
+    {
+        write(b.begin(), b.size());
+    }
+    void proceed_blk(const message* m, u32 count)
+    {
+        for(u32 i = 0; i != count; ++i, ++m)
+        {
+            if(blk->add(*m))
+                write(blk->flush());
+        }
+    }
+    void write_index(const message* m, u32 count)
+    {
+        u64 offset = fsize;
+        for(u32 i = 0; i != count; ++i, ++m, offset += message_size)
+        {
+            if(!((offset / message_size) % idx_period))
+            {
+                idx_record r = {m->t.time, offset, 0, 0};
+                wi->write((char_cit)&r, sizeof(r));
+            }
+            if(m->id == msg_instr && !is_snapshot(*m))
+            {
+                idx_record r = {m->t.time, offset, m->mi.security_id, 0};
+                wi->write((char_cit)&r, sizeof(r));
+            }
+            else if(m->id == msg_ping && is_snapshot(*m))
+            {
+                idx_record r = {m->t.time, offset, 0, 1};
+                wi->write((char_cit)&r, sizeof(r));
+            }
+        }
+    }
+    void update_books(const message* m, u32 count)
+    {
+        for(u32 i = 0; i != count; ++i, ++m)
+        {
+            if(m->id == msg_book)
+            {
+                auto it = books.find(m->mb.security_id);
+                if(it == books.end())
+                    continue;
+                book& b = it->second;
+                if(!m->mb.count)
+                    b.erase(m->mb.level_id);
+                else
+                {
+                    message_book& mb = b[m->mb.level_id];
+                    price_t price = m->mb.price.value ? m->mb.price : mb.price;
+                    mb = m->mb;
+                    mb.price = price;
+                }
+            }
+            else if(m->id == msg_instr)
+            {
+                book& b = books[m->mi.security_id];
+                b.clear();
+                b.mi = m->mi;
+            }
+            else if(m->id == msg_clean)
+            {
+                auto it = books.find(m->mc.security_id);
+                if(it != books.end())
+                    it->second.clear();
+            }
+        }
+    }
+    void write_snapshot(ttime_t time)
+    {
+        snap.clear();
+        message m;
+        memset(&m, 0, sizeof(m));
+        m.mp.id = msg_ping;
+        snap.push_back(m);
+        for(const auto& v: books)
+        {
+            m.mi = v.second.mi;
+            snap.push_back(m);
+            for(const auto& l: v.second)
+            {
+                m.mb = l.second;
+                snap.push_back(m);
+            }
+        }
+        u32 count = snap.size() - 1;
+        memcpy(snap[0].mp.unused, &count, sizeof(count));
+        for(message& s: snap)
+        {
+            s.t.time = time;
+            s.t.etime = snapshot_etime;
+        }
+        write_messages(snap.begin(), snap.size());
+    }
+    void write_messages(const message* m, u32 count)
     {
         if(bin)
+        {
+            if(hidx)
+                write_index(m, count);
             write((char_cit)m, message_size * count);
+        }
+        else if(!!blk)
+            proceed_blk(m, count);
         else
             proceed_csv(m, count);
     }
+    void proceed(const message* m, u32 count)
+    {
+        if((rotate_size || !!rotate_period) && count)
+            check_rotate(m[count - 1].t.time);
+
+        if(!!snapshot_period && count)
+        {
+            if(m->t.time >= snapshot_time)
+            {
+                MPROFILE("efile::snapshot")
+                write_snapshot(m->t.time);
+                snapshot_time = next_period(m->t.time, snapshot_period);
+            }
+            update_books(m, count);
+        }
+
+        write_messages(m, count);
+
+        if(count && m[count - 1].t.time >= flush_time)
+        {
+            w.handoff();
+            if(hidx)
+                wi->handoff();
+            flush_time = m[count - 1].t.time + flush_period;
+        }
+    }
     ~efile()
     {
-        ::close(hfile);
+        try
+        {
+            if(!!blk)
+            {
+                write(blk->flush());
+                write(blk->footer());
+            }
+            close_file();
+        }
+        catch(exception& e)
+        {
+            mlog(mlog::critical) << "efile::~efile() " << fname << ", " << e;
+        }
+        zip.reset();
     }
 };
 
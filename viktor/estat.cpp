@@ -3,11 +3,18 @@
 
     export = stat
     export = stat name
+    export = stat[ name][ brief][ period=seconds][ security|exchange]
+
+    deltas of et, tc and ec accumulated in log-linear histograms,
+    with period statistics of every period printed (by message time),
+    totals printed at exit, security or exchange adds statistics per group
 */
 
 #include "../makoa/exports.hpp"
 #include "../makoa/types.hpp"
 
+#include "../evie/fmap.hpp"
+#include "../evie/histogram.hpp"
 #include "../evie/math.hpp"
 #include "../evie/mlog.hpp"
 
@@ -15,17 +22,24 @@ namespace
 {
     struct estat
     {
+        enum
+        {
+            by_none, by_security, by_exchange
+        };
+
         bool brief;
         mstring name;
-        u32 count;
+        u64 count, interval_count;
+        ttime_t period, next_print;
+        u32 by;
 
+        template<typename histogram>
         struct stat
         {
-            ttime_t min, max;
+            histogram h;
             i128 sum, d2;
-            u64 count;
 
-            stat() : min(limits<ttime_t>::max), max(limits<ttime_t>::min), sum(), d2(), count()
+            stat() : sum(), d2()
             {
             }
             void add(ttime_t f, ttime_t t)
@@ -34,14 +48,25 @@ namespace
                     return;
 
                 ttime_t delta = t - f;
-                min = ::min(min, delta);
-                max = ::max(max, delta);
+                h.record(delta.value);
                 sum += i128(delta.value);
                 d2 += i128(delta.value) * delta.value / 1000000;
-                ++count;
+            }
+            void add(const stat& r)
+            {
+                h.add(r.h);
+                sum += r.sum;
+                d2 += r.d2;
+            }
+            void clear()
+            {
+                h.clear();
+                sum = 0;
+                d2 = 0;
             }
             void print(mlog& ml, mstring name) const
             {
+                u64 count = h.count();
                 if(count)
                 {
                     i128 mean = sum / count;
@@ -49,8 +74,10 @@ namespace
                     double var = to_double(d2) / count - dm * dm;
                     i64 stddev = i64(sqrt(abs(var)) * 1000);
                     ml << "\n    " << name << " count: " << count << ", mean: "
-                        << print_t({to_int(mean)}) << ", std: " << print_t({stddev}) <<
-                        ", min: " << print_t({min}) << ", max: " << print_t({max});
+                        << print_t({to_int(mean)}) << ", std: " << print_t({stddev})
+                        << ", min: " << print_t({h.min()}) << ", p50: " << print_t({h.percentile(50)})
+                        << ", p90: " << print_t({h.percentile(90)}) << ", p99: " << print_t({h.percentile(99)})
+                        << ", p99.9: " << print_t({h.percentile(99.9)}) << ", max: " << print_t({h.max()});
                 }
             }
         };
@@ -58,13 +85,13 @@ namespace
         //  ttime_t etime; //exchange time
         //  ttime_t time;  //parser time
         //  ttime_t ctime; //cur estat time
+        template<typename histogram>
         struct mstat
         {
-            stat et, tc, ec;
+            stat<histogram> et, tc, ec;
 
-            void print(mlog& ml, str_holder n) const
+            void print(mlog& ml, const mstring& name) const
             {
-                mstring name(n);
                 et.print(ml, name + "_et");
                 tc.print(ml, name + "_tc");
                 ec.print(ml, name + "_ec");
@@ -79,11 +106,124 @@ namespace
             {
                 et.add(etime, time);
             }
+            void add(const mstat& r)
+            {
+                et.add(r.et);
+                tc.add(r.tc);
+                ec.add(r.ec);
+            }
+            void clear()
+            {
+                et.clear();
+                tc.clear();
+                ec.clear();
+            }
         };
-        mstat mb, mt, mc, mi, mp;
+        template<typename histogram>
+        struct stats
+        {
+            mstat<histogram> mb, mt, mc, mi, mp;
 
-        void print() const
+            void print(mlog& ml, const mstring& prefix) const
+            {
+                mb.print(ml, prefix + "book");
+                mt.print(ml, prefix + "trades");
+                mc.print(ml, prefix + "clear");
+                mi.print(ml, prefix + "instr");
+                mp.print(ml, prefix + "ping");
+            }
+            void add(const stats& r)
+            {
+                mb.add(r.mb);
+                mt.add(r.mt);
+                mc.add(r.mc);
+                mi.add(r.mi);
+                mp.add(r.mp);
+            }
+            void clear()
+            {
+                mb.clear();
+                mt.clear();
+                mc.clear();
+                mi.clear();
+                mp.clear();
+            }
+        };
+        //statistics of period and total, all messages or security or exchange ones,
+        //groups use coarse histograms (12.5% error, 2.4KB per recorded delta kind)
+        template<typename histogram>
+        struct group_t
+        {
+            mstring name;
+            stats<histogram> cur, total;
+        };
+        typedef group_t<histogram_t<3> > group;
+        group_t<histogram> all;
+        mvector<unique_ptr<group> > groups;
+        fmap<u32, group*> securities;
+
+        group* get_group(u32 security_id)
+        {
+            auto it = securities.find(security_id);
+            if(it != securities.end())
+                return it->second;
+            return set_group(security_id, by == by_security ? to_string(security_id) : mstring("unknown"));
+        }
+        group* set_group(u32 security_id, const mstring& name)
+        {
+            group* g = nullptr;
+            if(by == by_exchange)
+            {
+                for(unique_ptr<group>& v: groups)
+                    if(v->name == name)
+                        g = v.get();
+            }
+            else
+            {
+                auto it = securities.find(security_id);
+                if(it != securities.end())
+                    g = it->second;
+            }
+            if(!g)
+            {
+                groups.push_back(unique_ptr<group>(new group()));
+                g = groups.back().get();
+            }
+            g->name = name;
+            securities[security_id] = g;
+            return g;
+        }
+        void print_period()
         {
+            if(interval_count)
+            {
+                mlog ml;
+                ml << "\nstat ";
+                if(!name.empty())
+                    ml << name << " ";
+                ml << "period " << print_t{period} << " proceed " << interval_count << " messages";
+                all.cur.print(ml, "");
+                for(const unique_ptr<group>& g: groups)
+                    g->cur.print(ml, g->name + " ");
+                ml << '\n';
+            }
+            flush();
+        }
+        //add period statistics to total
+        void flush()
+        {
+            all.total.add(all.cur);
+            all.cur.clear();
+            for(unique_ptr<group>& g: groups)
+            {
+                g->total.add(g->cur);
+                g->cur.clear();
+            }
+            interval_count = 0;
+        }
+        void print()
+        {
+            flush();
             if(count)
             {
                 mlog ml;
@@ -91,54 +231,110 @@ namespace
                 if(!name.empty())
                     ml << name << " ";
                 ml << "proceed " << count << " messages";
-                mb.print(ml, "book");
-                mt.print(ml, "trades");
-                mc.print(ml, "clear");
-                mi.print(ml, "instr");
-                mp.print(ml, "ping");
+                all.total.print(ml, "");
+                for(const unique_ptr<group>& g: groups)
+                    g->total.print(ml, g->name + " ");
                 ml << '\n';
             }
         }
-        estat(mstring params) : brief(params == "brief"), name(params), count()
+        estat(mstring params) : brief(), count(), interval_count(), period(), next_print(), by(by_none)
         {
+            for(str_holder p: split(str_holder(params.begin(), params.end()), ' '))
+            {
+                if(p == "brief")
+                    brief = true;
+                else if(p == "security")
+                    by = by_security;
+                else if(p == "exchange")
+                    by = by_exchange;
+                else if(p.size() > 7 && str_holder(p.begin(), 7) == "period=")
+                    period = seconds(lexical_cast<u32>(p.begin() + 7, p.end()));
+                else
+                    name = p;
+            }
             if(!params.empty())
                 params.push_back(' ');
 
             mlog() << "stat " << params << "initialized";
         }
+        void check_period(ttime_t time)
+        {
+            if(time >= next_print)
+            {
+                if(!!next_print)
+                    print_period();
+                next_print = time + period;
+            }
+        }
         void proceed(const message* mes, u32 count)
         {
             this->count += count;
-            if(brief)
+            for(u32 i = 0; i != count; ++i, ++mes)
             {
-                for(u32 i = 0; i != count; ++i, ++mes)
+                const message& m = *mes;
+                if(brief)
                 {
-                    const message& m = *mes;
+                    if(!!period)
+                        check_period(m.t.time);
+                    ++interval_count;
                     if(m.id == msg_book)
-                        mb.add(m.mb.etime, m.mb.time);
+                    {
+                        all.cur.mb.add(m.mb.etime, m.mb.time);
+                        if(by != by_none)
+                            get_group(m.mb.security_id)->cur.mb.add(m.mb.etime, m.mb.time);
+                    }
                     else if(m.id == msg_trade)
-                        mt.add(m.mt.etime, m.mt.time);
+                    {
+                        all.cur.mt.add(m.mt.etime, m.mt.time);
+                        if(by != by_none)
+                            get_group(m.mt.security_id)->cur.mt.add(m.mt.etime, m.mt.time);
+                    }
+                    else if(m.id == msg_instr && by != by_none)
+                        set_instr(m.mi);
                 }
-            }
-            else
-            {
-                for(u32 i = 0; i != count; ++i, ++mes)
+                else
                 {
-                    const message& m = *mes;
-                    ttime_t ctime = cur_ttime();
+                    ttime_t ctime = cur_ttime(m.t.time);
+                    if(!!period)
+                        check_period(ctime);
+                    ++interval_count;
                     if(m.id == msg_book)
-                        mb.add(m.mb.etime, m.mb.time, ctime);
+                    {
+                        all.cur.mb.add(m.mb.etime, m.mb.time, ctime);
+                        if(by != by_none)
+                            get_group(m.mb.security_id)->cur.mb.add(m.mb.etime, m.mb.time, ctime);
+                    }
                     else if(m.id == msg_trade)
-                        mt.add(m.mt.etime, m.mt.time, ctime);
+                    {
+                        all.cur.mt.add(m.mt.etime, m.mt.time, ctime);
+                        if(by != by_none)
+                            get_group(m.mt.security_id)->cur.mt.add(m.mt.etime, m.mt.time, ctime);
+                    }
                     else if(m.id == msg_clean)
-                        mc.add(m.mc.etime, m.mc.time, ctime);
+                    {
+                        all.cur.mc.add(m.mc.etime, m.mc.time, ctime);
+                        if(by != by_none)
+                            get_group(m.mc.security_id)->cur.mc.add(m.mc.etime, m.mc.time, ctime);
+                    }
                     else if(m.id == msg_instr)
-                        mi.add(ttime_t(), m.mi.time, ctime);
+                    {
+                        all.cur.mi.add(ttime_t(), m.mi.time, ctime);
+                        if(by != by_none)
+                            set_instr(m.mi)->cur.mi.add(ttime_t(), m.mi.time, ctime);
+                    }
                     else if(m.id == msg_ping)
-                        mp.add(m.mp.etime, m.mp.time, ctime);
+                        all.cur.mp.add(m.mp.etime, m.mp.time, ctime);
                 }
             }
         }
+        group* set_instr(const message_instr& mi)
+        {
+            str_holder exchange = from_array(mi.exchange_id);
+            if(by == by_exchange)
+                return set_group(mi.security_id, exchange);
+            return set_group(mi.security_id, exchange + "/" + from_array(mi.feed_id) + "/"
+                + from_array(mi.security));
+        }
         ~estat()
         {
             print();
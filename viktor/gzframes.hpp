@@ -0,0 +1,380 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    gzf, seekable gzip for recorded messages
+
+    file is concatenation of independent gzip members, every member holds
+    gzf_frame_size bytes of data (last one can be less) and FEXTRA subfield "MG"
+    with member size, data size and time range of frame messages
+    (zero for not bin data, csv backups compressed by efile).
+    file still can be unpacked by gzip -d, readers index frames by walking
+    member headers and inflate only frames they need
+*/
+
+#pragma once
+
+#include "block_cache.hpp"
+
+#include "../makoa/types.hpp"
+
+#include "../evie/algorithm.hpp"
+#include "../evie/mfile.hpp"
+#include "../evie/mlog.hpp"
+#include "../evie/string.hpp"
+#include "../evie/thread.hpp"
+#include "../evie/unique_ptr.hpp"
+
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const u32 gzf_frame_size = message_size * 64 * 1024;
+
+struct gzf_header
+{
+    u8 id1, id2, cm, flg;
+    u32 mtime;
+    u8 xfl, os;
+    u16 xlen;
+
+    //subfield
+    u8 si1, si2;
+    u16 len;
+    u32 csize, usize;
+    i64 tf, tt;
+} __attribute__((packed));
+
+static const u16 gzf_extra_size = sizeof(gzf_header) - offsetof(gzf_header, si1);
+
+struct gzf_index
+{
+    u64 offset, from;
+    ttime_t tf, tt;
+    u32 csize, usize;
+};
+
+class gzf_writer
+{
+    z_stream strm;
+    mvector<char> out;
+
+public:
+    gzf_writer() : strm()
+    {
+        if(deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK)
+            throw str_exception("gzf_writer() deflateInit2 error");
+    }
+    gzf_writer(const gzf_writer&) = delete;
+    ~gzf_writer()
+    {
+        deflateEnd(&strm);
+    }
+    //messages: data is bin messages stream, tf and tt filled from first and last message
+    str_holder compress(char_cit data, u32 size, bool messages)
+    {
+        if(deflateReset(&strm) != Z_OK)
+            throw str_exception("gzf_writer::compress() deflateReset error");
+
+        out.resize(sizeof(gzf_header) + deflateBound(&strm, size) + 8);
+        strm.next_in = (Bytef*)data;
+        strm.avail_in = size;
+        strm.next_out = (Bytef*)(out.begin() + sizeof(gzf_header));
+        strm.avail_out = out.size() - sizeof(gzf_header) - 8;
+        if(deflate(&strm, Z_FINISH) != Z_STREAM_END)
+            throw str_exception("gzf_writer::compress() deflate error");
+
+        char_it it = out.begin() + sizeof(gzf_header) + strm.total_out;
+        u32 crc = ::crc32(0, (const Bytef*)data, size);
+        memcpy(it, &crc, 4);
+        memcpy(it + 4, &size, 4);
+
+        gzf_header h = {0x1f, 0x8b, Z_DEFLATED, 4/*FEXTRA*/, 0, 0, 3/*unix*/, gzf_extra_size,
+            'M', 'G', u16(gzf_extra_size - 4), u32(it + 8 - out.begin()), size, 0, 0};
+        if(messages && size >= message_size)
+        {
+            h.tf = ((const message*)data)->t.time.value;
+            h.tt = ((const message*)(data + (size / message_size - 1) * message_size))->t.time.value;
+        }
+        memcpy(out.begin(), &h, sizeof(h));
+        return str_holder(out.begin(), h.csize);
+    }
+};
+
+//compress file from to framed gzip file to,
+//frames compressed by threads in parallel and written in order
+class gzf_compressor
+{
+    int hin, hout;
+    u64 fsize;
+    u32 frames, next;
+    mutex m;
+    condition cv;
+    bool messages, error;
+
+    void compress(u32 from, u32 step)
+    {
+        try
+        {
+            gzf_writer w;
+            mvector<char> buf(gzf_frame_size);
+            for(u32 i = from; i < frames; i += step)
+            {
+                u64 off = u64(i) * gzf_frame_size;
+                u32 sz = min<u64>(gzf_frame_size, fsize - off);
+                if(::pread(hin, buf.begin(), sz, off) != ssize_t(sz))
+                    throw_system_failure(es() % "gzf_compressor pread error, off: " % off);
+                str_holder d = w.compress(buf.begin(), sz, messages);
+
+                mutex::scoped_lock lock(m);
+                while(next != i && !error)
+                    cv.wait(lock);
+                if(error)
+                    return;
+                if(::write(hout, d.begin(), d.size()) != ssize_t(d.size()))
+                    throw_system_failure("gzf_compressor writing error");
+                ++next;
+                cv.notify_all();
+            }
+        }
+        catch(exception& e)
+        {
+            mlog(mlog::critical) << "gzf_compressor::compress() " << e;
+            mutex::scoped_lock lock(m);
+            error = true;
+            cv.notify_all();
+        }
+    }
+
+public:
+    gzf_compressor(int hin, int hout, u64 fsize, bool messages) : hin(hin), hout(hout), fsize(fsize),
+        frames((fsize + gzf_frame_size - 1) / gzf_frame_size), next(), messages(messages), error()
+    {
+    }
+    bool run(u32 threads)
+    {
+        threads = max<u32>(1, min(threads, frames));
+        mvector<jthread> thrds;
+        for(u32 i = 1; i < threads; ++i)
+            thrds.push_back(jthread(&gzf_compressor::compress, this, i, threads));
+        compress(0, threads);
+        for(jthread& t: thrds)
+            t.join();
+        return !error && next == frames;
+    }
+};
+
+//messages: from is bin messages file, frames time ranges stored for gzf_reader::narrow()
+inline void gzf_compress(char_cit from, char_cit to, bool messages, u32 threads = 1)
+{
+    mfile f(from);
+    int hfile = ::open(to, O_WRONLY | O_CREAT | O_TRUNC, S_IWRITE | S_IREAD | S_IRGRP | S_IWGRP);
+    if(hfile < 0)
+        throw_system_failure(es() % "gzf_compress() open file " % _str_holder(to) % " error");
+    mfile fo(hfile);
+
+    gzf_compressor c(f.hfile, hfile, f.size(), messages);
+    if(!c.run(threads))
+        throw mexception(es() % "gzf_compress() " % _str_holder(from) % " error");
+}
+
+//framed gzip output stream of bin messages, batch of threads frames compressed in parallel
+//and written in order
+class gzf_ostream
+{
+    int hout;
+    u32 threads, filled;
+    mvector<mvector<char> > frames;
+    mvector<unique_ptr<gzf_writer> > writers;
+    mvector<str_holder> out;
+
+    void compress(u32 i)
+    {
+        for(; i < filled; i += threads)
+            out[i] = writers[i]->compress(frames[i].begin(), frames[i].size(), true);
+    }
+    void flush()
+    {
+        if(frames.empty() || (!filled && frames[0].empty()))
+            return;
+        if(filled < threads && !frames[filled].empty())
+            ++filled;
+        {
+            mvector<jthread> thrds;
+            for(u32 i = 1; i < filled; ++i)
+                thrds.push_back(jthread(&gzf_ostream::compress, this, i));
+            compress(0);
+            for(jthread& t: thrds)
+                t.join();
+        }
+        for(u32 i = 0; i != filled; ++i)
+        {
+            if(::write(hout, out[i].begin(), out[i].size()) != ssize_t(out[i].size()))
+                throw_system_failure("gzf_ostream writing error");
+            frames[i].clear();
+        }
+        filled = 0;
+    }
+
+public:
+    gzf_ostream(int hout, u32 threads) : hout(hout), threads(max<u32>(1, threads)), filled(),
+        frames(this->threads), out(this->threads)
+    {
+        for(u32 i = 0; i != this->threads; ++i)
+        {
+            frames[i].reserve(gzf_frame_size);
+            writers.push_back(unique_ptr<gzf_writer>(new gzf_writer));
+        }
+    }
+    gzf_ostream(const gzf_ostream&) = delete;
+    void write(char_cit data, u64 size)
+    {
+        while(size)
+        {
+            mvector<char>& f = frames[filled];
+            u64 sz = min<u64>(size, gzf_frame_size - f.size());
+            f.insert(data, data + sz);
+            data += sz;
+            size -= sz;
+            if(f.size() == gzf_frame_size && ++filled == threads)
+                flush();
+        }
+    }
+    void close()
+    {
+        flush();
+    }
+};
+
+class gzf_reader
+{
+    int hfile;
+    u64 pos, fsize;
+    i64 cur;
+
+    z_stream strm;
+    mvector<char> raw, data;
+    mstring ckey;
+
+    void pread(void* p, u64 size, u64 off) const
+    {
+        if(::pread(hfile, p, size, off) != ssize_t(size))
+            throw_system_failure(es() % "gzf_reader::pread() error, size: " % size % ", off: " % off);
+    }
+    static bool check(const gzf_header& h)
+    {
+        return h.id1 == 0x1f && h.id2 == 0x8b && (h.flg & 4) && h.xlen >= gzf_extra_size
+            && h.si1 == 'M' && h.si2 == 'G' && h.len == gzf_extra_size - 4;
+    }
+
+public:
+    mvector<gzf_index> frames;
+
+    //check first member of file for gzf subfield
+    static bool is_gzf(int hfile)
+    {
+        gzf_header h;
+        return ::pread(hfile, &h, sizeof(h), 0) == sizeof(h) && check(h);
+    }
+    gzf_reader(int hfile) : hfile(hfile), pos(), fsize(), cur(-1), strm()
+    {
+        if(inflateInit2(&strm, MAX_WBITS + 16) != Z_OK)
+            throw str_exception("gzf_reader() inflateInit2 error");
+
+        struct stat st;
+        if(fstat(hfile, &st))
+            throw_system_failure("gzf_reader() fstat error");
+
+        gzf_header h;
+        for(u64 off = 0; off + sizeof(h) <= u64(st.st_size); off += h.csize)
+        {
+            pread(&h, sizeof(h), off);
+            if(!check(h) || off + h.csize > u64(st.st_size))
+            {
+                mlog(mlog::critical) << "gzf_reader() bad frame, off: " << off
+                    << ", file size: " << u64(st.st_size);
+                break;
+            }
+            frames.push_back({off, fsize, ttime_t{h.tf}, ttime_t{h.tt}, h.csize, h.usize});
+            fsize += h.usize;
+        }
+        ckey = block_cache::instance().key(hfile);
+    }
+    gzf_reader(const gzf_reader&) = delete;
+    ~gzf_reader()
+    {
+        inflateEnd(&strm);
+    }
+    u64 size() const
+    {
+        return fsize;
+    }
+    void seekg(u64 p)
+    {
+        if(p > fsize)
+            throw mexception(es() % "gzf_reader::seekg(), size " % fsize % ", pos " % p);
+        pos = p;
+    }
+    void seek_cur(i64 p)
+    {
+        seekg(pos + p);
+    }
+    const mvector<char>& frame(u32 i)
+    {
+        if(cur != i)
+        {
+            const gzf_index& f = frames[i];
+            block_cache& bc = block_cache::instance();
+            if(!bc.get(ckey, i, data) || data.size() != f.usize)
+            {
+                raw.resize(f.csize);
+                data.resize(f.usize);
+                pread(raw.begin(), f.csize, f.offset);
+                if(inflateReset(&strm) != Z_OK)
+                    throw str_exception("gzf_reader::frame() inflateReset error");
+                strm.next_in = (Bytef*)raw.begin();
+                strm.avail_in = f.csize;
+                strm.next_out = (Bytef*)data.begin();
+                strm.avail_out = f.usize;
+                if(inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.total_out != f.usize)
+                    throw mexception(es() % "gzf_reader::frame() inflate error, off: " % f.offset);
+                bc.put(ckey, i, data.begin(), data.size());
+            }
+            cur = i;
+        }
+        return data;
+    }
+    u64 read(char_it ptr, u64 sz)
+    {
+        u64 ret = 0;
+        sz = min(sz, fsize - pos);
+        while(ret != sz)
+        {
+            u32 i = (upper_bound(frames.begin(), frames.end(), pos,
+                [](u64 p, const gzf_index& f) {return p < f.from;}) - frames.begin()) - 1;
+            const mvector<char>& d = frame(i);
+            u64 off = pos - frames[i].from;
+            u64 r = min<u64>(sz - ret, d.size() - off);
+            memcpy(ptr + ret, d.begin() + off, r);
+            ret += r;
+            pos += r;
+        }
+        return ret;
+    }
+    //narrow [first, last) messages range that contains lower_bound for time t
+    void narrow(ttime_t t, i64& first, i64& last) const
+    {
+        if(frames.empty() || !frames.back().tt.value)
+            return;
+        auto it = lower_bound(frames.begin(), frames.end(), t,
+            [](const gzf_index& f, ttime_t t) {return f.tt < t;});
+        if(it == frames.end())
+            first = last = max<i64>(first, min<i64>(last, fsize / message_size));
+        else
+        {
+            first = max<i64>(first, it->from / message_size);
+            last = max<i64>(first, min<i64>(last, (it->from + it->usize) / message_size));
+        }
+    }
+};
@@ -2,6 +2,10 @@
    author: Ilya Andronov <sni4ok@yandex.ru>
 */
 
+#include "blocks.hpp"
+#include "gzframes.hpp"
+#include "index.hpp"
+
 #include "../makoa/types.hpp"
 
 #include "../alco/huobi/utils.hpp"
@@ -12,13 +16,14 @@
 #include "../evie/profiler.hpp"
 #include "../evie/mlog.hpp"
 #include "../evie/mstring.hpp"
+#include "../evie/thread.hpp"
 
-#include <map>
-#include <unordered_map>
-
+#include <time.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 static ttime_t parse_time(const mstring& time)
 {
@@ -41,10 +46,162 @@ char_cit find_last(const mstring& fname, char c)
     return it;
 }
 
+//mmap view of plain recording, mapped inside address range reserved once,
+//so pointers from data() stay valid when file grows, range reserved again
+//(and previous one kept till destruction) only if file outgrows it
+class mapped_file
+{
+    static const u64 readahead = 32 * 1024 * 1024, min_reserve = 16ull * 1024 * 1024 * 1024,
+        page = 4096;
+
+    int hfile;
+    char_cit ptr;
+    u64 msize, mapped, reserved, pos, advised;
+    mvector<pair<char_cit, u64> > retired;
+
+    void remap(u64 sz)
+    {
+        if(sz > reserved)
+        {
+            u64 r = max(min_reserve, (2 * sz + page - 1) & ~(page - 1));
+            void* p = mmap(nullptr, r, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if(p == MAP_FAILED)
+                throw_system_failure(es() % "mapped_file::remap() reserve error, size: " % r);
+            if(reserved)
+                retired.push_back({ptr, reserved});
+            ptr = (char_cit)p;
+            reserved = r;
+            mapped = 0;
+        }
+        u64 to = (sz + page - 1) & ~(page - 1);
+        if(to > mapped)
+        {
+            void* p = mmap((void*)(ptr + mapped), to - mapped, PROT_READ, MAP_SHARED | MAP_FIXED,
+                hfile, mapped);
+            if(p == MAP_FAILED)
+                throw_system_failure(es() % "mapped_file::remap() error, size: " % sz);
+            mapped = to;
+        }
+        msize = sz;
+    }
+
+public:
+    mapped_file(int hfile) : hfile(hfile), ptr(), msize(), mapped(), reserved(), pos(), advised()
+    {
+        update();
+    }
+    mapped_file(const mapped_file&) = delete;
+    ~mapped_file()
+    {
+        if(reserved)
+            munmap((void*)ptr, reserved);
+        for(auto& r: retired)
+            munmap((void*)r.first, r.second);
+    }
+    //remap if file grown, returns mapped size
+    u64 update()
+    {
+        struct stat st;
+        if(fstat(hfile, &st))
+            throw_system_failure("mapped_file::update() fstat error");
+        if(u64(st.st_size) > msize)
+            remap(st.st_size);
+        return msize;
+    }
+    u64 size()
+    {
+        return update();
+    }
+    void seekg(u64 p)
+    {
+        if(p > msize && p > update())
+            throw mexception(es() % "mapped_file::seekg(), size " % msize % ", pos " % p);
+        pos = p;
+    }
+    void seek_cur(i64 p)
+    {
+        seekg(pos + p);
+    }
+    //pointer to [from, to) range of file data
+    char_cit data(u64 from, u64 to)
+    {
+        if(to > msize && to > update())
+            throw mexception(es() % "mapped_file::data(), size " % msize % ", to " % to);
+        return ptr + from;
+    }
+    u64 read(char_it buf, u64 sz)
+    {
+        if(pos + sz > msize)
+            update();
+        sz = min(sz, msize - pos);
+        if(pos + sz > advised)
+        {
+            u64 from = pos & ~u64(4095);
+            madvise((void*)(ptr + from), min(readahead, msize - from), MADV_WILLNEED);
+            advised = from + readahead;
+        }
+        memcpy(buf, ptr + pos, sz);
+        pos += sz;
+        return sz;
+    }
+};
+
+//bin_index of files loaded by process, for long living readers (query server),
+//entry reloaded when index file size or mtime changed
+class index_cache
+{
+    struct entry
+    {
+        u64 size;
+        i64 mtime;
+        bin_index idx;
+    };
+    mutex m;
+    fmap<mstring, entry> files;
+
+public:
+    bool enabled = false;
+
+    static index_cache& instance()
+    {
+        static index_cache c;
+        return c;
+    }
+    void load(bin_index& idx, const mstring& fname)
+    {
+        struct stat st;
+        if(!enabled || stat(fname.c_str(), &st))
+        {
+            idx.load(fname);
+            return;
+        }
+        i64 mtime = st.st_mtim.tv_sec * ttime_t::frac + st.st_mtim.tv_nsec;
+        {
+            mutex::scoped_lock lock(m);
+            auto it = files.find(fname);
+            if(it != files.end() && it->second.size == u64(st.st_size) && it->second.mtime == mtime)
+            {
+                idx = it->second.idx;
+                return;
+            }
+        }
+        idx.load(fname);
+        mutex::scoped_lock lock(m);
+        entry& e = files[fname];
+        e.size = st.st_size;
+        e.mtime = mtime;
+        e.idx = idx;
+    }
+};
+
 struct zip_file
 {
     str_holder data;
     unique_ptr<zlibe> zip;
+    unique_ptr<blk_reader> blk;
+    unique_ptr<gzf_reader> gzf;
+    unique_ptr<mapped_file> mf;
+    bin_index idx;
     char_cit data_it;
     mfile f;
 
@@ -70,14 +227,32 @@ struct zip_file
         mlog() << "zip_file::open " << _str_holder(fname);
         close();
         str_holder fn = _str_holder(fname);
+        index_cache::instance().load(idx, fn + ".idx");
         if(fn.size() > 3 && str_holder(fn.end() - 3, fn.end()) == ".gz")
         {
-            mvector<char> f = read_file(fname);
-            u32 data_sz = zlib_file_sz(f, fn);
+            mfile file(fname);
+            if(gzf_reader::is_gzf(file.hfile))
+            {
+                zip.reset();
+                f.swap(file);
+                gzf.reset(new gzf_reader(f.hfile));
+                return;
+            }
+
             if(!zip)
                 zip.reset(new zlibe);
-            zip->dest.resize(data_sz);
-            data = zip->decompress(f.begin(), f.size());
+            block_cache& bc = block_cache::instance();
+            mstring ckey = bc.key(file.hfile);
+            if(bc.get(ckey, 0, zip->dest))
+                data = str_holder(zip->dest.begin(), zip->dest.size());
+            else
+            {
+                mvector<char> f = read_file(fname);
+                u32 data_sz = zlib_file_sz(f, fn);
+                zip->dest.resize(data_sz);
+                data = zip->decompress(f.begin(), f.size());
+                bc.put(ckey, 0, data.begin(), data.size());
+            }
             data_it = data.begin();
         }
         else
@@ -85,6 +260,10 @@ struct zip_file
             zip.reset();
             mfile file(fname);
             f.swap(file);
+            if(blk_reader::is_blk(f.hfile))
+                blk.reset(new blk_reader(f.hfile));
+            else
+                mf.reset(new mapped_file(f.hfile));
         }
     }
     void close()
@@ -93,6 +272,9 @@ struct zip_file
             data = str_holder();
         else
         {
+            blk.reset();
+            gzf.reset();
+            mf.reset();
             mfile file(0);
             f.swap(file);
         }
@@ -106,22 +288,48 @@ struct zip_file
                     % data.size() % ", pos " % pos);
             data_it = data.begin() + pos;
         }
+        else if(!!blk)
+            blk->seekg(pos);
+        else if(!!gzf)
+            gzf->seekg(pos);
         else
-            f.seekg(pos);
+            mf->seekg(pos);
     }
     void seek_cur(i64 pos)
     {
         if(!!zip)
             data_it += pos;
-        else if(::lseek(f.hfile, pos, SEEK_CUR) < 0)
-            throw_system_failure("lseek() error");
+        else if(!!blk)
+            blk->seek_cur(pos);
+        else if(!!gzf)
+            gzf->seek_cur(pos);
+        else
+            mf->seek_cur(pos);
     }
-    u64 size() const
+    u64 size()
     {
         if(!!zip)
             return data.size();
+        else if(!!blk)
+            return blk->size();
+        else if(!!gzf)
+            return gzf->size();
         else
-            return f.size();
+            return mf->size();
+    }
+    //file data [from, to) without copy, nullptr if file not mapped
+    char_cit mapped(u64 from, u64 to)
+    {
+        return !!mf ? mf->data(from, to) : nullptr;
+    }
+    //narrow [first, last) messages range for lower_bound by time, when file has index
+    void narrow(ttime_t t, i64& first, i64& last) const
+    {
+        if(!!blk)
+            blk->narrow(t, first, last);
+        else if(!!gzf)
+            gzf->narrow(t, first, last);
+        idx.narrow(t, first, last);
     }
     u64 read(char* ptr, u64 size)
     {
@@ -131,13 +339,12 @@ struct zip_file
             memcpy(ptr, data_it, sz);
             data_it += sz;
         }
+        else if(!!blk)
+            return blk->read(ptr, size);
+        else if(!!gzf)
+            return gzf->read(ptr, size);
         else
-        {
-            ssize_t r = ::read(f.hfile, ptr, size);
-            if(r < 0)
-                throw_system_failure(es() % "read() error, size: " % size);
-            return r;
-        }
+            return mf->read(ptr, size);
         return size;
     }
 };
@@ -169,15 +376,175 @@ public:
     }
 };
 
+//open addressing hash map with linear probing, clear() keeps capacity
+template<typename key, typename value>
+class flat_map
+{
+    mvector<key> keys;
+    mvector<value> values;
+    mvector<u8> used;
+    u64 count;
+
+    static u64 hash(key k)
+    {
+        u64 h = u64(k) * 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 32);
+    }
+    u64 slot(key k) const
+    {
+        u64 mask = keys.size() - 1, i = hash(k) & mask;
+        while(used[i] && keys[i] != k)
+            i = (i + 1) & mask;
+        return i;
+    }
+    void grow()
+    {
+        mvector<key> k;
+        mvector<value> v;
+        mvector<u8> u;
+        k.swap(keys);
+        v.swap(values);
+        u.swap(used);
+        u64 sz = max<u64>(16, k.size() * 2);
+        keys.resize(sz);
+        values.resize(sz);
+        used.resize(sz);
+        fill(used.begin(), used.end(), u8());
+        for(u64 i = 0; i != k.size(); ++i)
+        {
+            if(u[i])
+            {
+                u64 j = slot(k[i]);
+                keys[j] = k[i];
+                values[j] = v[i];
+                used[j] = 1;
+            }
+        }
+    }
+
+public:
+    typedef key key_type;
+    typedef value mapped_type;
+
+    flat_map() : count()
+    {
+    }
+    value* find(key k)
+    {
+        if(!count)
+            return nullptr;
+        u64 i = slot(k);
+        return used[i] ? &values[i] : nullptr;
+    }
+    value& operator[](key k)
+    {
+        if((count + 1) * 2 > keys.size())
+            grow();
+        u64 i = slot(k);
+        if(!used[i])
+        {
+            keys[i] = k;
+            values[i] = value();
+            used[i] = 1;
+            ++count;
+        }
+        return values[i];
+    }
+    void clear()
+    {
+        if(count)
+            fill(used.begin(), used.end(), u8());
+        count = 0;
+    }
+    u64 size() const
+    {
+        return count;
+    }
+    //values in table order
+    template<typename func>
+    void for_each(func f) const
+    {
+        for(u64 i = 0; i != keys.size(); ++i)
+            if(used[i])
+                f(values[i]);
+    }
+};
+
+static u32 compact_threads = 4;
+
+//builds books at start of history, securities partitioned by security_id % threads,
+//every shard processed by own thread, result ordered by security_id
 struct compact_book
 {
+    //messages count for parallel build
+    static const u64 parallel_from = 1024 * 1024;
+
     mvector<char> book;
     u64 book_off = 0;
 
-    struct orders_t : std::unordered_map<i64/*level_id*/, message_book>
+    struct orders_t : flat_map<i64/*level_id*/, message_book>
     {
         message_instr mi = message_instr();
     };
+    struct shard
+    {
+        flat_map<u32/*security_id*/, u32> idx;
+        mvector<orders_t> orders;
+        //securities with security_id % n == k
+        u32 k, n;
+
+        orders_t* find(u32 security_id)
+        {
+            u32* i = idx.find(security_id);
+            return i ? &orders[*i] : nullptr;
+        }
+        void proceed(const message* it, const message* ie)
+        {
+            for(; it != ie; ++it)
+            {
+                if(it->id == msg_book)
+                {
+                    const message_book& m = it->mb;
+                    if(m.security_id % n != k)
+                        continue;
+                    orders_t* o = find(m.security_id);
+                    if(o)
+                    {
+                        message_book& mb = (*o)[m.level_id];
+                        price_t price = m.price.value ? m.price : mb.price;
+                        mb = m;
+                        mb.price = price;
+                    }
+                }
+                else if(it->id == msg_instr)
+                {
+                    if(it->mi.security_id % n != k)
+                        continue;
+                    orders_t* o = find(it->mi.security_id);
+                    if(!o)
+                    {
+                        idx[it->mi.security_id] = orders.size();
+                        orders.push_back(orders_t());
+                        o = &orders.back();
+                    }
+                    o->clear();
+                    o->mi = it->mi;
+                }
+                else if(it->id == msg_clean)
+                {
+                    if(it->mc.security_id % n != k)
+                        continue;
+                    orders_t* o = find(it->mc.security_id);
+                    if(o)
+                        o->clear();
+                }
+                else
+                {
+                    ASSERT(it->id == msg_trade || it->id == msg_ping);
+                }
+            }
+        }
+    };
 
     void read(zip_file& f, const mstring& fname, u64 from, u64 to)
     {
@@ -185,79 +552,83 @@ struct compact_book
             throw mexception(es() % "compact_book::read() " % fname
                 % " from " % from % " to " % to);
 
-        ttime_t last_time = ttime_t();
-        last_used_c<std::map<u32, orders_t> > orders;
+        ttime_t ct = cur_ttime();
 
-        //read
-        mvector<message> buf((to - from) / message_size);
-        f.seekg(from);
-        f.read((char_it)(buf.begin()), to - from);
-        auto [it, ie] = be(buf);
+        //read, mapped files processed in place
+        mvector<message> buf;
+        const message *it = (const message*)f.mapped(from, to), *ie;
+        if(it)
+            ie = it + (to - from) / message_size;
+        else
+        {
+            buf.resize((to - from) / message_size);
+            f.seekg(from);
+            f.read((char_it)(buf.begin()), to - from);
+            it = buf.begin();
+            ie = buf.end();
+        }
+        ttime_t last_time = it != ie ? (ie - 1)->t.time : ttime_t();
 
-        for(; it != ie; ++it)
+        u32 n = u64(ie - it) < parallel_from ? 1 : max<u32>(1, compact_threads);
+        mvector<shard> shards(n);
         {
-            if(it->id == msg_book)
-            {
-                const message_book& m = it->mb;
-                orders_t& o = orders[m.security_id];
-                if(o.mi.security_id)
-                {
-                    message_book& mb = o[m.level_id];
-                    price_t price = m.price.value ? m.price : mb.price;
-                    mb = m;
-                    mb.price = price;
-                }
-            }
-            else if(it->id == msg_instr)
+            mvector<jthread> thrds;
+            for(u32 k = 0; k != n; ++k)
             {
-                orders_t& o = orders[it->mi.security_id];
-                o.clear();
-                o.mi = it->mi;
+                shards[k].k = k;
+                shards[k].n = n;
+                if(k)
+                    thrds.push_back(jthread(&shard::proceed, &shards[k], it, ie));
             }
-            else if(it->id == msg_clean)
-            {
-                orders_t& o = orders[it->mc.security_id];
-                o.clear();
-            }
-            else
-            {
-                ASSERT(it->id == msg_trade || it->id == msg_clean || it->id == msg_ping);
-            }
-            last_time = it->mt.time;
+            shards[0].proceed(it, ie);
+            for(jthread& t: thrds)
+                t.join();
         }
 
         //compact
-        buf.clear();
-
-        for(const auto& o: orders)
+        struct sec
+        {
+            u32 security_id;
+            const orders_t* o;
+        };
+        mvector<sec> secs;
+        for(shard& s: shards)
+            for(const orders_t& o: s.orders)
+                secs.push_back({o.mi.security_id, &o});
+        sort(secs.begin(), secs.end(), [](const sec& l, const sec& r)
+            {return l.security_id < r.security_id;});
+
+        mvector<message> res;
+        for(const sec& s: secs)
         {
-            ASSERT(o.second.mi.id == msg_instr);
+            ASSERT(s.o->mi.id == msg_instr);
             message m;
-            m.mi = o.second.mi;
+            m.mi = s.o->mi;
             m.mi.time = last_time;
             m.mi.etime = ttime_t();
-            buf.push_back(m);
+            res.push_back(m);
         }
 
-        for(const auto& o: orders)
+        for(const sec& s: secs)
         {
-            for(const auto& v: o.second)
+            s.o->for_each([&](const message_book& v)
             {
-                if(!v.second.count)
-                    continue;
+                if(!v.count)
+                    return;
 
                 message m;
-                ASSERT(!!v.second.price);
-                m.mb = v.second;
+                ASSERT(!!v.price);
+                m.mb = v;
                 m.mi.time = last_time;
                 m.mi.etime = ttime_t();
-                buf.push_back(m);
-            }
+                res.push_back(m);
+            });
         }
 
-        book.resize(buf.size() * message_size);
-        copy(buf.begin(), buf.begin() + buf.size(), (message*)(book.begin()));
-        mlog() << "compact_book::read() " << fname << " from " << from << " to " << to;
+        book.resize(res.size() * message_size);
+        copy(res.begin(), res.begin() + res.size(), (message*)(book.begin()));
+        mlog() << "compact_book::read() " << fname << " from " << from << " to " << to
+            << ", threads: " << n << ", securities: " << secs.size() << ", time: " << print_t{cur_ttime() - ct};
     }
 };
 
@@ -356,6 +727,36 @@ struct ifile
         return st.st_ino;
     }
 
+    //move nt.off after snapshot it points to, so snapshots before nt.off are complete
+    void skip_snapshot(u64 sz)
+    {
+        while(nt.off != sz)
+        {
+            u64 n = min<u64>(sz - nt.off, read_buf.size() * message_size);
+            cur_file.seekg(nt.off);
+            cur_file.read((char*)&read_buf[0], n);
+            auto it = read_buf.begin(), ie = it + n / message_size;
+            for(; it != ie && is_snapshot(*it); ++it)
+                nt.off += message_size;
+            if(it != ie)
+                break;
+        }
+    }
+    //remove snapshot messages from buf, returns new size
+    static u32 remove_snapshots(char_it buf, u32 size)
+    {
+        message *it = (message*)buf, *ie = it + size / message_size, *o = it;
+        for(; it != ie; ++it)
+        {
+            if(is_snapshot(*it))
+                continue;
+            if(o != it)
+                *o = *it;
+            ++o;
+        }
+        return (o - (message*)buf) * message_size;
+    }
+
     ttime_t add_file_impl(const mstring& fname)
     {
         bool last_file = fname == main_file.name;
@@ -400,12 +801,15 @@ struct ifile
                 ASSERT(nt.from == 0 && nt.off == 0);
                 static const u64 buf_size = message_size * 1024 * 1024;
                 read_buf.resize(buf_size / message_size);
-                nt.off = message_size * lower_bound_int(0, sz / message_size,
-                    main_file.tf, pred);
+                i64 first = 0, last = sz / message_size;
+                cur_file.narrow(main_file.tf, first, last);
+                nt.off = message_size * lower_bound_int(first, last, main_file.tf, pred);
+                skip_snapshot(sz);
                 last_used_c<fmap<u32/*security_id*/, u64 /*off*/> > tickers;
-                u64 off = nt.off;
+                u64 off = nt.off, snapshot = 0;
+                bool indexed = cur_file.idx.instr_from(nt.off, nt.from);
 
-                while(!nt.from && off)
+                while(!indexed && !nt.from && off)
                 {
                     nt.from = off < buf_size ? 0 : off - buf_size;
                     cur_file.seekg(nt.from);
@@ -422,16 +826,24 @@ struct ifile
                             tickers[it->mb.security_id];
                         else if(it->id == msg_trade)
                             tickers[it->mt.security_id];
+                        else if(it->id == msg_ping && is_snapshot(*it))
+                            snapshot = nt.from;
                     }
 
                     for(auto& v: tickers)
                         nt.from = min(nt.from, v.second);
+                    //books of all securities seeded from snapshot
+                    if(snapshot)
+                        nt.from = max(nt.from, snapshot);
                 }
             }
 
             if((nt.tt > main_file.tt) || (last_file && history))
-                nt.sz = message_size * lower_bound_int(nt.off / message_size,
-                    sz / message_size, main_file.tt, pred);
+            {
+                i64 first = nt.off / message_size, last = sz / message_size;
+                cur_file.narrow(main_file.tt, first, last);
+                nt.sz = message_size * lower_bound_int(first, last, main_file.tt, pred);
+            }
 
             cur_file.seekg(nt.off);
 
@@ -469,6 +881,8 @@ struct ifile
         {
             dirent *e = ee[i];
             str_holder fname(_str_holder(e->d_name));
+            if(fname.size() > 4 && str_holder(fname.end() - 4, fname.end()) == ".idx")
+                continue;
             if(fname.size() > f_size + 10 && equal(fname.begin(),
                 fname.begin() + f_size, f.begin()))
             {
@@ -623,6 +1037,9 @@ struct ifile
                         cur_file.seek_cur(-d);
                     }
                     nt.off += ret;
+                    ret = remove_snapshots(buf, ret);
+                    if(!ret)
+                        continue;
                 }
                 if(ret < 0)
                     throw_system_failure("ifile::read file error");
@@ -655,105 +1072,371 @@ struct ifile
     }
 };
 
-struct ifiles_replay
+//reads ifile by background thread into two buffers
+class prefetch
 {
-    volatile bool& can_run;
-    const double speed;
-    mvector<ifile> files;
+    static const u32 buf_messages = 16 * 1024;
 
-    ttime_t start_time, files_time;
-    queue<message> b;
-    mvector<queue<char> > b2;
+    ifile f;
+    mvector<message> bufs[2];
+    u32 sizes[2];
+    u64 filled, consumed;
+    bool eof, stop, holding;
+    mstring error;
 
-    ifiles_replay(volatile bool& can_run, const mvector<str_holder>& files,
-        ttime_t tf, ttime_t tt, double speed)
-        : can_run(can_run), speed(speed), files_time()
-    {
-        for(str_holder f: files)
-            this->files.emplace_back(can_run, f, tf, tt, true);
+    mutex m;
+    condition cv;
+    jthread thrd;
 
-        start_time = cur_ttime();
-        b2.resize(files.size());
-    }
-    u32 read(char_it buf, u32 buf_size)
+    void work_thread()
     {
-    rep:
-        for(u32 i = 0; i != files.size(); ++i)
+        for(;;)
         {
-            queue<char>& b2_ = b2[i];
-            if(b2_.size() < buf_size)
+            u32 i;
             {
-                b2_.reserve(b2_.buf_size() + 10 * buf_size);
-                u32 r = files[i].read(b2_.end(), buf_size);
-                b2_.add_size(r);
+                mutex::scoped_lock lock(m);
+                while(filled - consumed == 2 && !stop)
+                    cv.wait(lock);
+                if(stop)
+                    return;
+                i = filled % 2;
             }
-        }
 
-        u32 mc = buf_size / message_size;
-        while(b.size() != mc)
-        {
-            ttime_t min_time = limits<ttime_t>::max;
-            u32 min_idx = 0;
-            for(u32 i = 0; i != files.size(); ++i)
+            u32 sz = 0;
+            bool end = false;
+            try
             {
-                queue<char>& b2_ = b2[i];
-                if(b2_.size() >= message_size)
+                MPROFILE("prefetch::read")
+                while(sz != buf_messages)
                 {
-                    message* m = (message*)b2_.begin();
-                    if(m->t.time < min_time)
+                    u32 r = f.read((char_it)(bufs[i].begin() + sz), (buf_messages - sz) * message_size);
+                    if(!r)
                     {
-                        min_idx = i;
-                        min_time = m->t.time;
+                        end = true;
+                        break;
                     }
+                    sz += r / message_size;
                 }
             }
-            if(min_time == limits<ttime_t>::max)
+            catch(exception& e)
+            {
+                mutex::scoped_lock lock(m);
+                error = _str_holder(e.what());
+                end = true;
+            }
+
+            mutex::scoped_lock lock(m);
+            sizes[i] = sz;
+            if(sz)
+                ++filled;
+            eof = end;
+            cv.notify_all();
+            if(end)
+                return;
+        }
+    }
+
+public:
+    prefetch(volatile bool& can_run, const mstring& fname, ttime_t tf, ttime_t tt)
+        : f(can_run, fname, tf, tt, true), sizes(), filled(), consumed(),
+        eof(), stop(), holding()
+    {
+        for(mvector<message>& b: bufs)
+            b.resize(buf_messages);
+        thrd = jthread(&prefetch::work_thread, this);
+    }
+    prefetch(const prefetch&) = delete;
+    //release previous buffer and wait for next one, empty range at the end of file,
+    //reading error rethrown after messages read before it
+    pair<const message*, const message*> next()
+    {
+        mutex::scoped_lock lock(m);
+        if(holding)
+        {
+            ++consumed;
+            holding = false;
+            cv.notify_all();
+        }
+        if(filled == consumed && !eof)
+        {
+            MPROFILE("prefetch::wait")
+            while(filled == consumed && !eof)
+                cv.wait(lock);
+        }
+        if(filled == consumed)
+        {
+            if(!error.empty())
+                throw mexception(es() % "prefetch " % f.main_file.name % " " % error);
+            return {nullptr, nullptr};
+        }
+        holding = true;
+        const message* it = bufs[consumed % 2].begin();
+        return {it, it + sizes[consumed % 2]};
+    }
+    ~prefetch()
+    {
+        {
+            mutex::scoped_lock lock(m);
+            stop = true;
+            cv.notify_all();
+        }
+        thrd.join();
+    }
+};
+
+static ttime_t mono_ttime()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return ttime_t{i64(t.tv_sec) * ttime_t::frac + i64(t.tv_nsec)};
+}
+
+//precise pacing for files_replay, waits with clock_nanosleep(TIMER_ABSTIME)
+//and spins last spin_time before release, spin_time calibrated by oversleep
+class pacer
+{
+    volatile bool& can_run;
+
+    //abs release error histogram by log2 of microseconds
+    static const u32 buckets = 16;
+    u64 count, late, hist[buckets];
+    ttime_t err_sum, err_max;
+
+    static void sleep_until(ttime_t t)
+    {
+        timespec ts{t.value / ttime_t::frac, t.value % ttime_t::frac};
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+            ;
+    }
+
+public:
+    const ttime_t jitter;
+    ttime_t spin_time;
+
+    pacer(volatile bool& can_run, ttime_t jitter) : can_run(can_run), count(), late(), hist(),
+        err_sum(), err_max(), jitter(jitter), spin_time()
+    {
+        for(u32 i = 0; i != 20; ++i)
+        {
+            ttime_t t = mono_ttime() + microseconds(50);
+            sleep_until(t);
+            spin_time = max(spin_time, mono_ttime() - t);
+        }
+        spin_time = spin_time + spin_time + microseconds(10);
+        mlog() << "files_replay pacer, jitter: " << print_t{jitter} << ", spin_time: " << print_t{spin_time};
+    }
+    //returns false if interrupted
+    bool wait(ttime_t t)
+    {
+        for(;;)
+        {
+            ttime_t ct = mono_ttime();
+            ttime_t s = t - ct - spin_time;
+            if(s <= ttime_t())
                 break;
-            ASSERT(min_time != ttime_t());
+            sleep_until(ct + min(s, milliseconds(100)));
+            if(!can_run)
+                return false;
+        }
+        while(mono_ttime() < t)
+            __builtin_ia32_pause();
+        return true;
+    }
+    //err is release time minus target time, negative ones bounded by jitter
+    void add(ttime_t err)
+    {
+        if(err > jitter)
+            ++late;
+        if(err < ttime_t())
+            err = ttime_t() - err;
+        ++count;
+        err_sum = err_sum + err;
+        err_max = max(err_max, err);
+        u64 us = to_us(err);
+        u32 b = us ? min<u32>(buckets - 1, 64 - __builtin_clzll(us)) : 0;
+        ++hist[b];
+    }
+    ~pacer()
+    {
+        mlog ml;
+        ml << "files_replay pacing, messages: " << count << ", late: " << late;
+        if(count)
+        {
+            ml << ", mean error: " << print_t{ttime_t{err_sum.value / i64(count)}}
+                << ", max error: " << print_t{err_max} << "\n  ";
+            for(u32 i = 0; i != buckets; ++i)
+                if(hist[i])
+                    ml << " <" << (u64(1) << i) << "us: " << hist[i];
+        }
+    }
+};
 
-            queue<char>& b2_ = b2[min_idx];
-            message* m = (message*)b2_.begin();
-            b.push_back(*m);
-            b2_.pop_front(message_size);
+struct ifiles_replay
+{
+    struct cursor
+    {
+        const message *it, *ie;
+        u32 idx;
+
+        bool operator<(const cursor& c) const
+        {
+            return it->t.time < c.it->t.time || (it->t.time == c.it->t.time && idx < c.idx);
         }
+    };
 
-        auto [mb, me] = be(b);
-        auto mi = mb;
+    volatile bool& can_run;
+    //speed 0 for max mode, messages streamed without pacing
+    const double speed;
+    //set for precise mode, every message released at its scaled time
+    unique_ptr<pacer> p;
+    mvector<unique_ptr<prefetch> > files;
+    //binary heap of files cursors, min on top
+    mvector<cursor> heap;
+
+    ttime_t start_time, files_time;
+
+    void sift_down(u32 i)
+    {
+        u32 sz = heap.size();
+        for(;;)
+        {
+            u32 l = 2 * i + 1, r = l + 1, m = i;
+            if(l < sz && heap[l] < heap[m])
+                m = l;
+            if(r < sz && heap[r] < heap[m])
+                m = r;
+            if(m == i)
+                return;
+            simple_swap(heap[i], heap[m]);
+            i = m;
+        }
+    }
+    void next(cursor& c)
+    {
+        auto [it, ie] = files[c.idx]->next();
+        if(it == ie)
+        {
+            c = heap.back();
+            heap.pop_back();
+        }
+        else
+        {
+            c.it = it;
+            c.ie = ie;
+        }
+        if(!heap.empty())
+            sift_down(0);
+    }
+    ifiles_replay(volatile bool& can_run, const mvector<str_holder>& files,
+        ttime_t tf, ttime_t tt, double speed, pacer* p)
+        : can_run(can_run), speed(speed), p(p), files_time()
+    {
+        for(str_holder f: files)
+            this->files.push_back(unique_ptr<prefetch>(new prefetch(can_run, f, tf, tt)));
+
+        for(u32 i = 0; i != files.size(); ++i)
+        {
+            auto [it, ie] = this->files[i]->next();
+            if(it != ie)
+                heap.push_back({it, ie, i});
+        }
+        for(u32 i = heap.size() / 2; i--;)
+            sift_down(i);
+
+        start_time = mono_ttime();
+    }
+    ttime_t release_time(ttime_t t) const
+    {
+        return start_time + ttime_t{i64((t - files_time).value / speed)};
+    }
+    void reinit(ttime_t mt)
+    {
+        sleep_break(can_run, seconds(10));
+        start_time = mono_ttime();
+        files_time = mt;
+        mlog() << "ifile_replay() reinit, files_time: " << files_time;
+    }
+    //sources filled by files indexes of messages when set
+    u32 read(char_it buf, u32 buf_size, u16* sources = nullptr)
+    {
+    rep:
+        if(heap.empty())
+            return 0;
 
         if(!files_time) [[unlikely]]
-            files_time = mb->t.time;
+            files_time = heap[0].it->t.time;
 
-        ttime_t t = cur_ttime();
-        ttime_t dt = {i64((t - start_time).value * speed)};
-        ttime_t f_to = files_time + dt;
+        ttime_t dt = {}, f_to = limits<ttime_t>::max, ct = {};
+        if(!!p)
+        {
+            ttime_t mt = heap[0].it->t.time;
+            ttime_t rt = release_time(mt);
+            if(rt - mono_ttime() >= seconds(11))
+            {
+                reinit(mt);
+                goto rep;
+            }
+            if(!p->wait(rt))
+                return 0;
+            ct = mono_ttime();
+            f_to = files_time + ttime_t{i64((ct + p->jitter - start_time).value * speed)};
+        }
+        else if(speed)
+        {
+            dt = {i64((mono_ttime() - start_time).value * speed)};
+            f_to = files_time + dt;
+        }
 
-        for(; mi != me; ++mi)
+        u32 mc = buf_size / message_size, ret = 0;
+        message* out = (message*)buf;
+        while(ret != mc && !heap.empty())
         {
-            if(mi->t.time > f_to)
+            cursor& c = heap[0];
+            ASSERT(c.it->t.time != ttime_t());
+            if(c.it->t.time > f_to)
                 break;
+
+            //emit run of messages until next file head
+            const cursor* n = nullptr;
+            if(heap.size() > 1)
+                n = &heap[1];
+            if(heap.size() > 2 && heap[2] < heap[1])
+                n = &heap[2];
+
+            const message* from = c.it;
+            const message* to = c.it + min<u64>(c.ie - c.it, mc - ret);
+            while(c.it != to && c.it->t.time <= f_to && (!n || c < *n))
+                ++c.it;
+            copy(from, c.it, out + ret);
+            if(sources)
+                fill(sources + ret, sources + ret + (c.it - from), u16(c.idx));
+            ret += c.it - from;
+
+            if(c.it == c.ie)
+                next(c);
+            else
+                sift_down(0);
         }
 
-        u32 ret = mi - mb;
-        copy((char_cit)mb, (char_cit)mi, buf);
-        b.pop_front(ret);
+        if(!!p)
+        {
+            for(u32 i = 0; i != ret; ++i)
+                p->add(ct - release_time(out[i].t.time));
+            return ret * message_size;
+        }
 
-        if(!ret && !b.empty())
+        if(!ret && !heap.empty())
         {
             if(!can_run)
                 return 0;
 
-            ttime_t s = mb->t.time - files_time - dt;
+            ttime_t mt = heap[0].it->t.time;
+            ttime_t s = mt - files_time - dt;
             ASSERT(s >= ttime_t());
             if(s < seconds(11))
                 sleep_break(can_run, s);
             else
-            {
-                sleep_break(can_run, seconds(10));
-                start_time = cur_ttime();
-                files_time = mb->t.time;
-                mlog() << "ifile_replay() reinit, start_time: "
-                    << start_time << ", files_time: " << files_time;
-            }
+                reinit(mt);
             goto rep;
         }
         return ret * message_size;
@@ -766,12 +1449,25 @@ extern "C"
     {
         mvector<str_holder> p = split(_str_holder(params), ' ');
         if(p.empty() || p.size() > 4)
-            throw str_exception("files_replay_create() speed file_name[ time_from[ time_to]]");
-        double speed = lexical_cast<double>(p[0]);
+            throw str_exception("files_replay_create() speed[:jitter_us]|max file_name[ time_from[ time_to]]");
+        double speed = 0;
+        i64 jitter = -1;
+        if(p[0] == "max")
+            *get_virtual_time() = true;
+        else
+        {
+            mvector<str_holder> sp = split(p[0], ':');
+            speed = lexical_cast<double>(sp[0]);
+            if(speed <= 0 || sp.size() > 2)
+                throw mexception(es() % "files_replay_create() bad speed: " % p[0]);
+            if(sp.size() == 2)
+                jitter = lexical_cast<i64>(sp[1]);
+        }
         mvector<str_holder> files = split(p[1], ',');
         ttime_t tf = p.size() > 2 ? parse_time(p[2]) : limits<ttime_t>::min;
         ttime_t tt = p.size() > 3 ? parse_time(p[3]) : limits<ttime_t>::max;
-        return new ifiles_replay(can_run, files, tf, tt, speed);
+        return new ifiles_replay(can_run, files, tf, tt, speed,
+            jitter >= 0 ? new pacer(can_run, microseconds(jitter)) : nullptr);
     }
 
     void files_replay_destroy(void* v)
@@ -784,6 +1480,27 @@ extern "C"
         return ((ifiles_replay*)v)->read(buf, buf_size);
     }
 
+    void* files_merge_create(const char* files, volatile bool& can_run)
+    {
+        mvector<str_holder> f = split(_str_holder(files), ',');
+        return new ifiles_replay(can_run, f, limits<ttime_t>::min, limits<ttime_t>::max, 0, nullptr);
+    }
+
+    u32 files_merge_read(void* v, char* buf, u32 buf_size, u16* sources)
+    {
+        return ((ifiles_replay*)v)->read(buf, buf_size, sources);
+    }
+
+    void ifile_set_compact_threads(u32 threads)
+    {
+        compact_threads = threads;
+    }
+
+    void ifile_set_index_cache(bool enabled)
+    {
+        index_cache::instance().enabled = enabled;
+    }
+
     void* ifile_create(char_cit params, volatile bool& can_run)
     {
         mvector<str_holder> p = split(_str_holder(params), ' ');
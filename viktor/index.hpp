@@ -0,0 +1,119 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    idx, sidecar index for recorded bin files, file_name.idx
+
+    efile appends idx_record for every msg_instr and checkpoint
+    every idx_period messages, offsets are in uncompressed data,
+    so index remains valid when data file compressed to file_name.gz
+    (index renamed to file_name.gz.idx then)
+
+    optional snapshots (efile snapshot_period) is msg_ping marker followed by
+    msg_instr and live msg_book levels of every security, all snapshot messages
+    have etime snapshot_etime so readers skip them, idx_record with
+    snapshot flag points to marker
+*/
+
+#pragma once
+
+#include "../makoa/types.hpp"
+
+#include "../evie/algorithm.hpp"
+#include "../evie/fmap.hpp"
+#include "../evie/mfile.hpp"
+#include "../evie/mstring.hpp"
+
+static const u32 idx_period = 4096;
+static const ttime_t snapshot_etime = {-1};
+
+inline bool is_snapshot(const message& m)
+{
+    return m.t.etime == snapshot_etime;
+}
+
+struct idx_record
+{
+    ttime_t time;
+    u64 offset;
+    u32 security_id; //0 for checkpoint
+    u32 snapshot; //1 for snapshot marker, security_id is 0 then
+};
+
+struct bin_index
+{
+    mvector<idx_record> checkpoints, instrs, snapshots;
+    //min over securities of last msg_instr offset for every instrs prefix
+    mvector<u64> instr_min;
+
+    bool empty() const
+    {
+        return checkpoints.empty();
+    }
+    void load(const mstring& fname)
+    {
+        checkpoints.clear();
+        instrs.clear();
+        snapshots.clear();
+        instr_min.clear();
+
+        mvector<char> buf;
+        if(!read_file(buf, fname.c_str(), true))
+            return;
+        const idx_record* it = (const idx_record*)buf.begin();
+        const idx_record* ie = it + buf.size() / sizeof(idx_record);
+        for(; it != ie; ++it)
+        {
+            if(it->snapshot)
+                snapshots.push_back(*it);
+            else if(it->security_id)
+                instrs.push_back(*it);
+            else
+                checkpoints.push_back(*it);
+        }
+
+        //first record not superseded by later msg_instr of same security only moves forward
+        fmap<u32, u32> last;
+        mvector<u8> superseded(instrs.size());
+        instr_min.resize(instrs.size());
+        for(u32 i = 0, f = 0; i != instrs.size(); ++i)
+        {
+            u32& l = last[instrs[i].security_id];
+            if(l)
+                superseded[l - 1] = true;
+            l = i + 1;
+            while(superseded[f])
+                ++f;
+            instr_min[i] = instrs[f].offset;
+        }
+    }
+    //index covers data up to offset off
+    bool covered(u64 off) const
+    {
+        return !empty() && off <= checkpoints.back().offset + idx_period * message_size;
+    }
+    void narrow(ttime_t t, i64& first, i64& last) const
+    {
+        if(empty())
+            return;
+        auto it = lower_bound(checkpoints.begin(), checkpoints.end(), t,
+            [](const idx_record& r, ttime_t t) {return r.time < t;});
+        if(it != checkpoints.begin())
+            first = max<i64>(first, (it - 1)->offset / message_size);
+        if(it != checkpoints.end())
+            last = max<i64>(first, min<i64>(last, it->offset / message_size));
+    }
+    //min over securities of last msg_instr offset before off,
+    //but not earlier than last snapshot before off
+    bool instr_from(u64 off, u64& from) const
+    {
+        if(!covered(off))
+            return false;
+        auto less = [](const idx_record& r, u64 off) {return r.offset < off;};
+        auto i = lower_bound(instrs.begin(), instrs.end(), off, less);
+        from = (i == instrs.begin() ? off : instr_min[i - instrs.begin() - 1]);
+        auto it = lower_bound(snapshots.begin(), snapshots.end(), off, less);
+        if(it != snapshots.begin())
+            from = max(from, (it - 1)->offset);
+        return true;
+    }
+};
@@ -0,0 +1,245 @@
+/*
+    author: Ilya Andronov <sni4ok@yandex.ru>
+
+    query, server of recorded data over unix socket
+    usage: query socket_path root_dir
+
+    request is text line, file is recording name relative to root_dir
+    (rotated parts and year/month folders found by ifile), times in ifile format:
+        stream file time_from time_to[ security_id,security_id]
+        book file time[ security_id,security_id]
+    book returns instruments and books of securities at time
+
+    response is line "ok" or "error description", after ok chunks of
+    messages follows, every chunk is u32 size and data, zero size ends response
+
+    indexes of opened files kept in memory, decompressed blocks shared
+    by block_cache (1024MB if block_cache environment variable not set)
+*/
+
+#include "../makoa/imports.hpp"
+#include "../makoa/types.hpp"
+
+#include "../evie/atomic.hpp"
+#include "../evie/fset.hpp"
+#include "../evie/mlog.hpp"
+#include "../evie/mstring.hpp"
+#include "../evie/signals.hpp"
+#include "../evie/socket.hpp"
+#include "../evie/string.hpp"
+#include "../evie/thread.hpp"
+
+#include <poll.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+static const u32 query_max_request = 4096, query_buf_messages = 64 * 1024;
+
+static u32 sessions = 0;
+
+static u32 security_id(const message& m)
+{
+    if(m.id == msg_book)
+        return m.mb.security_id;
+    else if(m.id == msg_trade)
+        return m.mt.security_id;
+    else if(m.id == msg_instr)
+        return m.mi.security_id;
+    else if(m.id == msg_clean)
+        return m.mc.security_id;
+    return 0;
+}
+
+class session
+{
+    const mstring& root;
+    int socket;
+    mvector<char> request;
+    mvector<message> buf;
+
+    void send(char_cit data, u32 size)
+    {
+        socket_send(socket, (char_cit)&size, sizeof(size));
+        if(size)
+            socket_send(socket, data, size);
+    }
+    //false when client disconnected
+    bool read_request()
+    {
+        request.clear();
+        char c;
+        while(can_run)
+        {
+            if(!check_socket(socket, POLLIN, 100, "query::read_request()"))
+                continue;
+            int ret = ::recv(socket, &c, 1, 0);
+            if(ret <= 0)
+                return false;
+            if(c == '\n')
+                return true;
+            if(request.size() == query_max_request)
+                throw str_exception("query, request too long");
+            request.push_back(c);
+        }
+        return false;
+    }
+    u64 proceed(str_holder r)
+    {
+        mvector<str_holder> p = split(r, ' ');
+        bool book = !p.empty() && p[0] == "book";
+        if(p.empty() || (!book && p[0] != "stream") || p.size() < (book ? 3 : 4)
+            || p.size() > (book ? 4 : 5))
+            throw str_exception("query, unsupported request");
+
+        str_holder fname = p[1];
+        char_cit dots = "..";
+        if(fname.empty() || fname[0] == '/' || search(fname.begin(), fname.end(), dots, dots + 2) != fname.end())
+            throw mexception(es() % "query, bad file name: " % fname);
+
+        str_holder tf = p[2], tt = book ? p[2] : p[3];
+        fset<u32> ids;
+        if(p.size() == (book ? 4u : 5u))
+            for(str_holder id: split(p.back(), ','))
+                ids.insert(lexical_cast<u32>(id));
+
+        volatile bool can_run_session = true;
+        mstring params = "history " + root + fname + " " + tf + " " + tt;
+        void* f = ifile_create(params.c_str(), can_run_session);
+        socket_send(socket, "ok\n", 3);
+        u64 count = 0;
+        try
+        {
+            while(can_run)
+            {
+                u32 n = ifile_read(f, (char_it)buf.begin(), query_buf_messages * message_size) / message_size;
+                if(!n)
+                    break;
+                if(!ids.empty())
+                {
+                    u32 r = 0;
+                    for(u32 i = 0; i != n; ++i)
+                        if(ids.find(security_id(buf[i])) != ids.end())
+                            buf[r++] = buf[i];
+                    n = r;
+                }
+                if(n)
+                    send((char_cit)buf.begin(), n * message_size);
+                count += n;
+            }
+        }
+        catch(exception&)
+        {
+            ifile_destroy(f);
+            throw;
+        }
+        ifile_destroy(f);
+        send(nullptr, 0);
+        return count;
+    }
+
+public:
+    session(const mstring& root, int socket) : root(root), socket(socket), buf(query_buf_messages)
+    {
+    }
+    void run()
+    {
+        while(read_request())
+        {
+            str_holder r(request.begin(), request.end());
+            ttime_t ct = cur_ttime();
+            try
+            {
+                u64 count = proceed(r);
+                mlog() << "query " << r << ", messages: " << count << ", time: " << print_t{cur_ttime() - ct};
+            }
+            catch(exception& e)
+            {
+                mlog(mlog::critical) << "query " << r << ", " << e;
+                mstring err = "error " + _str_holder(e.what()) + "\n";
+                socket_send(socket, err.begin(), err.size());
+                return;
+            }
+        }
+    }
+};
+
+static void run_session(const mstring* root, int socket)
+{
+    socket_holder sh(socket);
+    try
+    {
+        session(*root, socket).run();
+    }
+    catch(exception& e)
+    {
+        mlog(mlog::critical) << "query session " << e;
+    }
+    atomic_sub(sessions, 1u);
+}
+
+int main(int argc, char** argv)
+{
+    auto log = log_init("query.log", mlog::always_cout);
+    signals_holder sl;
+    try
+    {
+        if(argc != 3)
+            throw str_exception("usage: query socket_path root_dir");
+
+        setenv("block_cache", "1024", 0);
+        ifile_set_index_cache(true);
+
+        mstring path = _str_holder(argv[1]), root = _str_holder(argv[2]);
+        if(root.empty() || root.back() != '/')
+            root = root + "/";
+
+        sockaddr_un addr = sockaddr_un();
+        if(path.size() >= sizeof(addr.sun_path))
+            throw mexception(es() % "query, socket path too long: " % path);
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.begin(), path.size());
+
+        int s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(s < 0)
+            throw_system_failure("query, open socket error");
+        socket_holder sh(s);
+        unlink(path.c_str());
+        if(bind(s, (sockaddr*)&addr, sizeof(addr)) < 0)
+            throw_system_failure(es() % "query, bind " % path % " error");
+        if(listen(s, 16) < 0)
+            throw_system_failure("query, listen error");
+        mlog() << "query listening " << path << ", root: " << root;
+
+        pollfd pfd = pollfd();
+        pfd.events = POLLIN;
+        pfd.fd = s;
+        while(can_run)
+        {
+            int ret = poll(&pfd, 1, 100);
+            if(ret < 0 && errno != EINTR)
+                throw_system_failure("query, poll error");
+            if(ret <= 0)
+                continue;
+            int c = accept(s, nullptr, nullptr);
+            if(c < 0)
+            {
+                mlog(mlog::critical) << "query, accept error";
+                continue;
+            }
+            atomic_add(sessions, 1u);
+            jthread(&run_session, &root, c).detach();
+        }
+        while(atomic_load(sessions))
+            usleep(10000);
+        unlink(path.c_str());
+    }
+    catch(exception& e)
+    {
+        mlog() << "main, " << e;
+        return 1;
+    }
+    return 0;
+}
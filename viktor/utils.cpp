@@ -3,15 +3,27 @@
 */
 
 
+#include "gzframes.hpp"
+
+#include "../makoa/imports.hpp"
+#include "../makoa/order_book.hpp"
+#include "../makoa/trace.hpp"
 #include "../makoa/types.hpp"
 
+#include "../evie/atomic.hpp"
 #include "../evie/mfile.hpp"
 #include "../evie/mstring.hpp"
 #include "../evie/fset.hpp"
+#include "../evie/histogram.hpp"
+#include "../evie/json.hpp"
 #include "../evie/signals.hpp"
 #include "../evie/mlog.hpp"
+#include "../evie/queue.hpp"
+#include "../evie/stream_file.hpp"
 #include "../evie/string.hpp"
 
+#include <unordered_map>
+
 #include <unistd.h>
 #include <dirent.h>
 
@@ -109,6 +121,62 @@ void test_impl(str_holder a1, str_holder a2)
     unused(v1, v2);
 }
 
+u64 xorshift(u64& s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+//random numbers, mostly well formed, parsed by lexical_cast and generic read_decimal_impl
+template<typename type>
+void decimal_fuzz(u32 count)
+{
+    const char chars[] = "0123456789.-eE+ ";
+    char buf[40];
+    u64 seed = 88172645463325252ull;
+    for(u32 i = 0; i != count; ++i)
+    {
+        u32 sz = 1 + xorshift(seed) % 26;
+        bool plain = xorshift(seed) % 4;
+        char_it it = buf;
+        if(plain && !(xorshift(seed) % 3))
+            *it++ = '-';
+        u32 dot = plain ? xorshift(seed) % (sz + 1) : sz;
+        for(u32 j = 0; j != sz; ++j)
+        {
+            if(j == dot)
+                *it++ = '.';
+            else if(plain)
+                *it++ = '0' + xorshift(seed) % 10;
+            else
+                *it++ = chars[xorshift(seed) % (sizeof(chars) - 1)];
+        }
+
+        i64 v1 = 0, v2 = 0;
+        bool e1 = false, e2 = false;
+        try
+        {
+            v1 = read_decimal_impl(buf, it, type::exponent);
+        }
+        catch(exception&)
+        {
+            e1 = true;
+        }
+        try
+        {
+            v2 = lexical_cast<type>(buf, it).value;
+        }
+        catch(exception&)
+        {
+            e2 = true;
+        }
+        if(e1 != e2 || v1 != v2)
+            throw mexception(es() % "decimal_fuzz, parsers differ for: " % str_holder(buf, it));
+    }
+}
+
 void amount_test()
 {
     test_impl("-0.5E-50", "0");
@@ -131,9 +199,72 @@ void amount_test()
     test_io(limits<count_t>::max);
     test_io(limits<count_t>::min);
 
+    decimal_fuzz<price_t>(1000000);
+    decimal_fuzz<count_t>(1000000);
+
     cout() << "amount_test successfully ended";
 }
 
+//lexical_cast of plain prices and amounts against generic read_decimal_impl
+void amount_bench()
+{
+    const u32 count = 1000000;
+    mvector<char> buf;
+    mvector<u32> offsets;
+    buf.reserve(count * 20);
+    u64 seed = 88172645463325252ull;
+    for(u32 i = 0; i != count; ++i)
+    {
+        char num[32];
+        buf_stream str(num);
+        str << xorshift(seed) % 1000000;
+        u32 frac = xorshift(seed) % 9;
+        if(frac)
+        {
+            str << '.';
+            for(u32 j = 0; j != frac; ++j)
+                str << char('0' + xorshift(seed) % 10);
+        }
+        offsets.push_back(buf.size());
+        buf.insert(buf.end(), str.begin(), str.end());
+    }
+    offsets.push_back(buf.size());
+
+    volatile i64 sink = 0;
+    auto bench = [&](str_holder name, auto&& func)
+    {
+        ttime_t ct = cur_ttime();
+        i64 sum = 0;
+        for(u32 r = 0; r != 10; ++r)
+            for(u32 i = 0; i != count; ++i)
+                sum += func(buf.begin() + offsets[i], buf.begin() + offsets[i + 1]);
+        ttime_t d = cur_ttime() - ct;
+        sink = sink + sum;
+        mlog() << "amount_bench " << name << ": " << print_t{d} << ", "
+            << double(d.value) / (count * 10) << " ns per number";
+    };
+    bench("price read_decimal_impl", [](char_cit it, char_cit ie)
+        {
+            return read_decimal_impl(it, ie, price_t::exponent);
+        }
+    );
+    bench("price lexical_cast", [](char_cit it, char_cit ie)
+        {
+            return lexical_cast<price_t>(it, ie).value;
+        }
+    );
+    bench("count read_decimal_impl", [](char_cit it, char_cit ie)
+        {
+            return read_decimal_impl(it, ie, count_t::exponent);
+        }
+    );
+    bench("count lexical_cast", [](char_cit it, char_cit ie)
+        {
+            return lexical_cast<count_t>(it, ie).value;
+        }
+    );
+}
+
 void clear_screen()
 {
     cout(false) << "\033[2J\033[1;1H";
@@ -203,6 +334,726 @@ void parsers_stat(str_holder f)
     }
 }
 
+static const u32 merge_threads = 4;
+
+//drops duplicates of messages equal except time and trace id within window,
+//every key emitted max over sources times, so repeated messages of one source kept
+class dedupe
+{
+    struct entry
+    {
+        ttime_t last;
+        u32 emitted;
+        mvector<u32> seen;
+    };
+
+    //message without time and trace id
+    static message key(const message& m)
+    {
+        message k = m;
+        k.t.time = ttime_t();
+        if(k.id == msg_book)
+            set_trace_id(k.mb, 0);
+        else if(k.id == msg_trade)
+            set_trace_id(k.mt, 0);
+        return k;
+    }
+    struct hash
+    {
+        u64 operator()(const message& m) const
+        {
+            const u64* it = (const u64*)&m;
+            u64 h = 0xcbf29ce484222325ull;
+            for(u32 i = 1; i != message_size / 8; ++i)
+            {
+                h = (h ^ it[i]) * 0x9e3779b97f4a7c15ull;
+                h ^= h >> 29;
+            }
+            return h;
+        }
+    };
+    struct equal
+    {
+        bool operator()(const message& l, const message& r) const
+        {
+            return !memcmp(&l, &r, message_size);
+        }
+    };
+
+    ttime_t window;
+    u32 sources;
+    std::unordered_map<message, entry, hash, equal> keys;
+    queue<pair<ttime_t, message> > order;
+
+public:
+    u64 dropped;
+
+    dedupe(ttime_t window, u32 sources) : window(window), sources(sources), dropped()
+    {
+    }
+    bool add(const message& m, u16 source)
+    {
+        while(!order.empty() && order.front().first + window < m.t.time)
+        {
+            auto it = keys.find(order.front().second);
+            if(it != keys.end() && it->second.last == order.front().first)
+                keys.erase(it);
+            order.pop_front();
+        }
+
+        message k = key(m);
+        entry& e = keys[k];
+        e.last = m.t.time;
+        order.push_back({m.t.time, k});
+        if(e.seen.empty())
+            e.seen.resize(sources);
+        if(++e.seen[source] > e.emitted)
+        {
+            ++e.emitted;
+            return true;
+        }
+        ++dropped;
+        return false;
+    }
+};
+
+//merge recordings (with their rotated parts) by time into one .bin or framed .gz file
+void merge(str_holder out, str_holder files, ttime_t window)
+{
+    volatile bool can_run = true;
+    u32 sources_count = split(files, ',').size();
+
+    bool gz = out.size() > 3 && str_holder(out.end() - 3, out.end()) == ".gz";
+    mstring fname = out;
+    int hfile = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IWRITE | S_IREAD | S_IRGRP | S_IWGRP);
+    if(hfile < 0)
+        throw_system_failure(es() % "merge() open file " % out % " error");
+    mfile f(hfile);
+    unique_ptr<gzf_ostream> gzs;
+    if(gz)
+        gzs.reset(new gzf_ostream(hfile, merge_threads));
+
+    void* v = files_merge_create(mstring(files).c_str(), can_run);
+    static const u32 buf_messages = 64 * 1024;
+    mvector<message> buf(buf_messages), res(buf_messages);
+    mvector<u16> sources(buf_messages);
+    dedupe d(window, sources_count);
+    u64 count = 0, written = 0;
+    ttime_t ct = cur_ttime();
+    try
+    {
+        for(;;)
+        {
+            u32 n = files_merge_read(v, (char_it)buf.begin(), buf_messages * message_size, sources.begin()) / message_size;
+            if(!n)
+                break;
+            u32 r = 0;
+            for(u32 i = 0; i != n; ++i)
+                if(d.add(buf[i], sources[i]))
+                    res[r++] = buf[i];
+            if(gz)
+                gzs->write((char_cit)res.begin(), r * message_size);
+            else if(::write(hfile, res.begin(), r * message_size) != ssize_t(r * message_size))
+                throw_system_failure("merge() writing error");
+            count += n;
+            written += r;
+        }
+        if(gz)
+            gzs->close();
+    }
+    catch(exception&)
+    {
+        files_replay_destroy(v);
+        throw;
+    }
+    files_replay_destroy(v);
+    mlog() << "merge() " << out << " readed " << count << " messages, written " << written
+        << ", duplicates dropped " << d.dropped << ", time: " << print_t{cur_ttime() - ct};
+}
+
+//bar of one security for [time, time + interval), book fields filled only with book features,
+//bid, ask and counts are top of book at bar end, spread is mean over book updates,
+//bars without trades have open, high, low and close equal to previous close
+struct bar
+{
+    ttime_t time;
+    price_t open, high, low, close;
+    count_t volume, buy_volume;
+    u32 trades, book_updates;
+    price_t bid, ask, spread;
+    count_t bid_count, ask_count;
+};
+
+//bars of recording, securities split by security_id % shards,
+//shard threads live for whole file and proceed same buffer in parallel while next buffer read
+class bars_file
+{
+    struct security
+    {
+        message_instr mi;
+        order_book_ba ob;
+        bar cur;
+        u32 spreads;
+        mvector<bar> bars;
+
+        security() : mi(), cur(), spreads()
+        {
+        }
+    };
+    typedef std::unordered_map<u32, security> securities;
+
+    ttime_t interval;
+    bool book;
+    mvector<unique_ptr<securities> > shards;
+
+    //buffer for shard threads, every shard proceeds it once per generation
+    mutex m;
+    condition cv;
+    const message *from, *to;
+    u64 generation;
+    u32 done;
+    bool stop;
+    mstring error;
+
+    void work_thread(u32 k)
+    {
+        for(u64 g = 1;; ++g)
+        {
+            const message *it, *ie;
+            {
+                mutex::scoped_lock lock(m);
+                while(generation < g && !stop)
+                    cv.wait(lock);
+                if(generation < g)
+                    return;
+                it = from;
+                ie = to;
+            }
+            try
+            {
+                proceed(k, it, ie);
+            }
+            catch(exception& e)
+            {
+                mutex::scoped_lock lock(m);
+                error = _str_holder(e.what());
+            }
+            mutex::scoped_lock lock(m);
+            ++done;
+            cv.notify_all();
+        }
+    }
+    void post(const message* it, const message* ie)
+    {
+        mutex::scoped_lock lock(m);
+        from = it;
+        to = ie;
+        done = 0;
+        ++generation;
+        cv.notify_all();
+    }
+    void wait()
+    {
+        mutex::scoped_lock lock(m);
+        while(done != shards.size())
+            cv.wait(lock);
+        if(!error.empty())
+            throw mexception(es() % "bars_file " % error);
+    }
+    void stop_threads(mvector<jthread>& thrds)
+    {
+        {
+            mutex::scoped_lock lock(m);
+            stop = true;
+            cv.notify_all();
+        }
+        for(jthread& t: thrds)
+            t.join();
+    }
+
+    void close_bar(security& s)
+    {
+        bar& b = s.cur;
+        if(book)
+        {
+            if(!s.ob.asks.empty())
+            {
+                b.ask = s.ob.asks.begin()->first;
+                b.ask_count = s.ob.asks.begin()->second.count;
+            }
+            if(!s.ob.bids.empty())
+            {
+                b.bid = s.ob.bids.begin()->first;
+                b.bid_count = s.ob.bids.begin()->second.count;
+            }
+            if(s.spreads)
+                b.spread.value /= s.spreads;
+        }
+        if(!b.trades && !s.bars.empty())
+            b.open = b.high = b.low = b.close = s.bars.back().close;
+        s.bars.push_back(b);
+    }
+    security& get(securities& secs, u32 security_id, ttime_t time)
+    {
+        security& s = secs[security_id];
+        if(time >= s.cur.time + interval)
+        {
+            if(s.cur.trades || s.cur.book_updates)
+                close_bar(s);
+            s.cur = bar();
+            s.cur.time.value = time.value - time.value % interval.value;
+            s.spreads = 0;
+        }
+        return s;
+    }
+    void proceed(u32 k, const message* it, const message* ie)
+    {
+        securities& secs = *shards[k];
+        u32 n = shards.size();
+        for(; it != ie; ++it)
+        {
+            const message& m = *it;
+            if(m.id == msg_trade)
+            {
+                if(m.mt.security_id % n != k)
+                    continue;
+                bar& b = get(secs, m.mt.security_id, m.t.time).cur;
+                if(!b.trades)
+                    b.open = b.high = b.low = m.mt.price;
+                else
+                {
+                    b.high = max(b.high, m.mt.price);
+                    b.low = min(b.low, m.mt.price);
+                }
+                b.close = m.mt.price;
+                b.volume += m.mt.count;
+                if(m.mt.direction == 1)
+                    b.buy_volume += m.mt.count;
+                ++b.trades;
+            }
+            else if(m.id == msg_book)
+            {
+                if(!book || m.mb.security_id % n != k)
+                    continue;
+                security& s = get(secs, m.mb.security_id, m.t.time);
+                s.ob.proceed(m);
+                ++s.cur.book_updates;
+                if(!s.ob.asks.empty() && !s.ob.bids.empty())
+                {
+                    s.cur.spread += s.ob.asks.begin()->first - s.ob.bids.begin()->first;
+                    ++s.spreads;
+                }
+            }
+            else if(m.id == msg_instr)
+            {
+                if(m.mi.security_id % n != k)
+                    continue;
+                security& s = get(secs, m.mi.security_id, m.t.time);
+                s.mi = m.mi;
+                if(book)
+                    s.ob.proceed(m);
+            }
+            else if(m.id == msg_clean)
+            {
+                if(book && m.mc.security_id % n == k)
+                    get(secs, m.mc.security_id, m.t.time).ob.proceed(m);
+            }
+        }
+    }
+    void write(const mstring& prefix, bool csv, u32 security_id, const security& s) const
+    {
+        mstring fname = prefix;
+        if(s.mi.security_id)
+            fname = fname + "_" + from_array(s.mi.exchange_id) + "_" + from_array(s.mi.feed_id)
+                + "_" + from_array(s.mi.security);
+        else
+            fname = fname + "_" + to_string(security_id);
+        for(char_it it = fname.begin() + prefix.size(); it != fname.end(); ++it)
+            if(*it == '/' || *it == ' ')
+                *it = '-';
+
+        if(!csv)
+        {
+            write_file((fname + ".bin").c_str(), (char_cit)s.bars.begin(), s.bars.size() * sizeof(bar), true);
+            return;
+        }
+        fname += ".csv";
+        csv_file f(str_holder(fname.begin(), fname.end()), true);
+        f << "time,open,high,low,close,volume,buy_volume,trades";
+        if(book)
+            f << ",book_updates,bid,ask,bid_count,ask_count,spread,imbalance";
+        f << endl;
+        u32 rows = 0;
+        for(const bar& b: s.bars)
+        {
+            f << b.time.value << ',' << b.open << ',' << b.high << ',' << b.low << ',' << b.close
+                << ',' << b.volume << ',' << b.buy_volume << ',' << b.trades;
+            if(book)
+            {
+                double c = to_double(b.bid_count) + to_double(b.ask_count);
+                f << ',' << b.book_updates << ',' << b.bid << ',' << b.ask << ',' << b.bid_count
+                    << ',' << b.ask_count << ',' << b.spread << ','
+                    << (c > 0 ? (to_double(b.bid_count) - to_double(b.ask_count)) / c : 0.);
+            }
+            f << endl;
+            //1024 rows fit in half of stream buffer
+            if(!(++rows % 1024))
+                f << flush_file;
+        }
+    }
+
+public:
+    bars_file(ttime_t interval, bool book, u32 shards) : interval(interval), book(book),
+        from(), to(), generation(), done(), stop()
+    {
+        for(u32 k = 0; k != shards; ++k)
+            this->shards.push_back(unique_ptr<securities>(new securities));
+    }
+    //returns messages count
+    u64 run(const mstring& fname, const mstring& prefix, bool csv)
+    {
+        static const u32 buf_messages = 64 * 1024;
+        volatile bool can_run = true;
+        void* f = ifile_create(("history " + fname).c_str(), can_run);
+        mvector<message> bufs[2] = {mvector<message>(buf_messages), mvector<message>(buf_messages)};
+        u64 count = 0;
+        mvector<jthread> thrds;
+        for(u32 k = 0; k != shards.size(); ++k)
+            thrds.push_back(jthread(&bars_file::work_thread, this, k));
+        try
+        {
+            u32 n = ifile_read(f, (char_it)bufs[0].begin(), buf_messages * message_size) / message_size;
+            for(u32 i = 0; n; i = !i)
+            {
+                post(bufs[i].begin(), bufs[i].begin() + n);
+                count += n;
+                try
+                {
+                    n = ifile_read(f, (char_it)bufs[!i].begin(), buf_messages * message_size) / message_size;
+                }
+                catch(exception&)
+                {
+                    wait();
+                    throw;
+                }
+                wait();
+            }
+        }
+        catch(exception&)
+        {
+            stop_threads(thrds);
+            ifile_destroy(f);
+            throw;
+        }
+        stop_threads(thrds);
+        ifile_destroy(f);
+
+        for(unique_ptr<securities>& secs: shards)
+        {
+            for(auto& v: *secs)
+            {
+                if(v.second.cur.trades || v.second.cur.book_updates)
+                    close_bar(v.second);
+                write(prefix, csv, v.first, v.second);
+            }
+        }
+        return count;
+    }
+};
+
+//OHLCV (and book features) bars of recordings, files proceed by threads in parallel,
+//when files less than threads securities of every file split between threads too,
+//table per file and security written to out_dir/file_name_exchange_feed_security.(csv|bin)
+void bars(str_holder out_dir, str_holder files, ttime_t interval, bool book, bool csv)
+{
+    if(!interval.value)
+        throw str_exception("bars() zero interval");
+    mvector<mstring> fnames = split_s(files);
+    u32 threads = max<long>(1, sysconf(_SC_NPROCESSORS_ONLN));
+    u32 workers = min<u32>(threads, fnames.size()), shards = max<u32>(1, threads / fnames.size());
+    mstring dir = out_dir;
+    if(dir.empty() || dir.back() != '/')
+        dir = dir + "/";
+    create_directories(dir.c_str());
+
+    u32 next = 0;
+    u64 count = 0;
+    bool error = false;
+    ttime_t ct = cur_ttime();
+    auto work = [&]()
+    {
+        try
+        {
+            for(u32 i = atomic_add(next, 1u) - 1; i < fnames.size() && !error; i = atomic_add(next, 1u) - 1)
+            {
+                const mstring& f = fnames[i];
+                char_cit n = f.end();
+                while(n != f.begin() && *(n - 1) != '/')
+                    --n;
+                bars_file b(interval, book, shards);
+                atomic_add(count, b.run(f, dir + str_holder(n, f.end()), csv));
+            }
+        }
+        catch(exception& e)
+        {
+            mlog(mlog::critical) << "bars() " << e;
+            error = true;
+        }
+    };
+    {
+        mvector<jthread> thrds;
+        for(u32 i = 1; i < workers; ++i)
+            thrds.push_back(jthread(&decltype(work)::operator(), &work));
+        work();
+        for(jthread& t: thrds)
+            t.join();
+    }
+    if(error)
+        throw str_exception("bars() failed");
+    mlog() << "bars() " << fnames.size() << " files, " << count << " messages, threads: "
+        << workers << "x" << shards << ", time: " << print_t{cur_ttime() - ct};
+}
+
+//time of books build for history start, serial and by threads
+void seed_bench(str_holder fname, str_holder time, u32 threads)
+{
+    volatile bool can_run = true;
+    mstring params = "history " + fname + " " + time;
+    for(u32 t: {1u, threads})
+    {
+        ifile_set_compact_threads(t);
+        ttime_t ct = cur_ttime();
+        void* f = ifile_create(params.c_str(), can_run);
+        ttime_t d = cur_ttime() - ct;
+        ifile_destroy(f);
+        mlog() << "seed_bench threads: " << t << ", time: " << print_t{d};
+    }
+}
+
+//per hop latencies of traced messages from trace rings of makoa chain (files in chain order),
+//records joined by security_id, trace id and origin time (parser session), every exporter
+//of process is own path: import of previous process -> import -> dequeue#n -> export#n
+void join(str_holder files)
+{
+    struct record : trace_record
+    {
+        u32 file;
+    };
+    mvector<mstring> fnames = split_s(files);
+    mvector<record> records;
+    for(u32 i = 0; i != fnames.size(); ++i)
+    {
+        mvector<char> buf = read_file(fnames[i].c_str());
+        const trace_header* h = (const trace_header*)buf.begin();
+        if(buf.size() < sizeof(trace_header) || h->magic != trace_magic
+            || buf.size() < sizeof(trace_header) + h->capacity * sizeof(trace_record))
+            throw mexception(es() % "join() bad trace file " % fnames[i]);
+        u64 n = min(h->count, h->capacity);
+        const trace_record* r = (const trace_record*)(h + 1);
+        for(u64 j = 0; j != n; ++j)
+            records.push_back({r[j], i});
+        mlog() << "join() " << fnames[i] << ", records: " << n << ", lost: " << h->count - n;
+    }
+    auto same = [](const record& l, const record& r)
+    {
+        return l.security_id == r.security_id && l.id == r.id && l.origin == r.origin;
+    };
+    //import first in every process, then dequeue and export of every exporter
+    sort(records.begin(), records.end(), [](const record& l, const record& r)
+        {
+            if(l.security_id != r.security_id)
+                return l.security_id < r.security_id;
+            if(l.id != r.id)
+                return l.id < r.id;
+            if(l.origin != r.origin)
+                return l.origin < r.origin;
+            if(l.file != r.file)
+                return l.file < r.file;
+            if((l.hop == trace_import) != (r.hop == trace_import))
+                return l.hop == trace_import;
+            if(l.exporter != r.exporter)
+                return l.exporter < r.exporter;
+            if(l.hop != r.hop)
+                return l.hop < r.hop;
+            return l.time < r.time;
+        }
+    );
+
+    mvector<mstring> names;
+    for(const mstring& f: fnames)
+    {
+        char_cit n = f.end();
+        while(n != f.begin() && *(n - 1) != '/')
+            --n;
+        names.push_back(str_holder(n, f.end()));
+    }
+    auto label = [&](const record& r)
+    {
+        mstring l = names[r.file] + (r.hop == trace_import ? str_holder(":import")
+            : r.hop == trace_dequeue ? str_holder(":dequeue") : str_holder(":export"));
+        if(r.hop != trace_import)
+            l = l + "#" + to_string(r.exporter);
+        return l;
+    };
+
+    mvector<pair<mstring, histogram> > hops;
+    auto add_hop = [&](const mstring& from, const mstring& to, ttime_t delta)
+    {
+        mstring hop = from + " -> " + to;
+        auto h = find_if(hops.begin(), hops.end(),
+            [&](const pair<mstring, histogram>& v) {return v.first == hop;});
+        if(h == hops.end())
+        {
+            hops.push_back({hop, histogram()});
+            h = hops.end() - 1;
+        }
+        h->second.record(delta.value);
+    };
+    histogram total;
+    u64 traces = 0;
+    for(auto it = records.begin(), ie = records.end(); it != ie;)
+    {
+        auto e = it + 1;
+        while(e != ie && same(*e, *it))
+            ++e;
+        ttime_t origin = it->origin;
+        mstring prev = "origin";
+        ttime_t pt = origin;
+        while(it != e)
+        {
+            u32 file = it->file;
+            if(it->hop == trace_import)
+            {
+                mstring l = label(*it);
+                add_hop(prev, l, it->time - pt);
+                prev = l;
+                pt = it->time;
+                ++it;
+            }
+            for(; it != e && it->file == file; ++it)
+            {
+                if(it->hop != trace_dequeue)
+                    continue;
+                mstring l = label(*it);
+                add_hop(prev, l, it->time - pt);
+                auto ex = it + 1;
+                if(ex != e && ex->file == file && ex->exporter == it->exporter && ex->hop == trace_export)
+                {
+                    add_hop(l, label(*ex), ex->time - it->time);
+                    if(file + 1 == fnames.size())
+                        total.record((ex->time - origin).value);
+                }
+            }
+        }
+        ++traces;
+    }
+
+    mlog ml;
+    ml << "join() traces: " << traces << "\n";
+    auto print = [&](str_holder name, const histogram& h)
+    {
+        ml << name << ": count: " << h.count() << ", p50: " << print_t{ttime_t{h.percentile(50)}}
+            << ", p99: " << print_t{ttime_t{h.percentile(99)}} << ", max: " << print_t{ttime_t{h.max()}} << "\n";
+    };
+    for(const auto& h: hops)
+        print(h.first.str(), h.second);
+    print("total", total);
+}
+
+//json structural index throughput on lws_dump captures, scalar and avx2 indexes
+//compared per frame, walk by find(',') and byte loop balance for reference
+void json_scan(str_holder files)
+{
+    mvector<mstring> fnames = split_s(files);
+    for(const mstring& fname: fnames)
+    {
+        mvector<char> buf = read_file(fname.c_str());
+        mvector<str_holder> frames;
+        for(char_cit it = buf.begin(), ie = buf.end(); it != ie;)
+        {
+            u32 sz;
+            if(ie - it < 6 || it[0] != '\n' || it[5] != '\n')
+                throw mexception(es() % "json_scan() bad lws_dump file " % fname);
+            memcpy(&sz, it + 1, sizeof(sz));
+            it += 6;
+            if(u32(ie - it) < sz)
+                throw mexception(es() % "json_scan() bad lws_dump file " % fname);
+            frames.push_back(str_holder(it, sz));
+            it += sz;
+        }
+
+        json_index scalar, simd;
+        u64 structurals = 0;
+        for(const str_holder& f: frames)
+        {
+            scalar.build_scalar(f.begin(), f.end());
+            simd.build(f.begin(), f.end());
+            if(scalar.pos.size() != simd.pos.size()
+                || memcmp(scalar.pos.begin(), simd.pos.begin(), scalar.pos.size() * sizeof(u32)))
+                throw mexception(es() % "json_scan() scalar and avx2 indexes differ, file " % fname
+                    % ", frame: " % u64(&f - frames.begin()));
+            structurals += simd.pos.size();
+        }
+
+        u64 size = buf.size() - frames.size() * 6, rounds = max<u64>(1, (256 << 20) / max<u64>(size, 1));
+        volatile u64 sink = 0;
+        auto bench = [&](str_holder name, auto&& func)
+        {
+            ttime_t ct = cur_ttime();
+            for(u64 r = 0; r != rounds; ++r)
+                for(const str_holder& f: frames)
+                    func(f.begin(), f.end());
+            ttime_t d = cur_ttime() - ct;
+            mlog() << "json_scan " << fname << " " << name << ": " << print_t{d} << ", "
+                << (size * rounds) / max<i64>(d.value / 1000, 1) << " MB/s";
+        };
+        mlog() << "json_scan " << fname << ", frames: " << frames.size() << ", bytes: " << size
+            << ", structurals: " << structurals << ", rounds: " << rounds;
+        bench("find walk", [&](char_cit it, char_cit ie)
+            {
+                for(it = find(it, ie, ','); it != ie; it = find(it + 1, ie, ','))
+                    sink = sink + 1;
+            }
+        );
+        bench("scalar index", [&](char_cit it, char_cit ie)
+            {
+                scalar.build_scalar(it, ie);
+            }
+        );
+        bench("avx2 index", [&](char_cit it, char_cit ie)
+            {
+                simd.build(it, ie);
+            }
+        );
+        bench("avx2 index and cursor walk", [&](char_cit it, char_cit ie)
+            {
+                simd.build(it, ie);
+                json_cursor c(simd);
+                for(it = c.find(it, ','); it != ie; it = c.find(it + 1, ','))
+                    sink = sink + 1;
+            }
+        );
+        bench("balance byte loop", [&](char_cit it, char_cit ie)
+            {
+                i64 b = 0;
+                for(; it != ie; ++it)
+                {
+                    if(*it == '{')
+                        ++b;
+                    else if(*it == '}')
+                        --b;
+                }
+                sink = sink + b;
+            }
+        );
+        bench("bytes_balance", [&](char_cit it, char_cit ie)
+            {
+                sink = sink + bytes_balance(it, ie, '{', '}');
+            }
+        );
+    }
+}
+
 int main(int argc, char** argv)
 {
     auto log = log_init("utils.log", mlog::always_cout);
@@ -214,8 +1065,30 @@ int main(int argc, char** argv)
             sort_data_by_folders(_str_holder(argv[2]));
         else if(argc == 2 && _str_holder(argv[1]) == "amount_test")
             amount_test();
+        else if(argc == 2 && _str_holder(argv[1]) == "amount_bench")
+            amount_bench();
         else if(argc == 3 && _str_holder(argv[1]) == "parsers_stat")
             parsers_stat(_str_holder(argv[2]));
+        else if((argc == 4 || argc == 5) && _str_holder(argv[1]) == "merge")
+            merge(_str_holder(argv[2]), _str_holder(argv[3]),
+                milliseconds(argc == 5 ? lexical_cast<u32>(_str_holder(argv[4])) : 1000));
+        else if((argc == 4 || argc == 5) && _str_holder(argv[1]) == "seed_bench")
+            seed_bench(_str_holder(argv[2]), _str_holder(argv[3]),
+                argc == 5 ? lexical_cast<u32>(_str_holder(argv[4])) : 4);
+        else if(argc >= 5 && argc <= 7 && _str_holder(argv[1]) == "bars")
+        {
+            //bars out_dir file1,file2 interval_sec[ trades|book[ csv|bin]]
+            str_holder features = argc >= 6 ? _str_holder(argv[5]) : "trades";
+            str_holder format = argc == 7 ? _str_holder(argv[6]) : "csv";
+            if(!from_any(features, "trades", "book") || !from_any(format, "csv", "bin"))
+                throw str_exception("bars out_dir files interval_sec[ trades|book[ csv|bin]]");
+            bars(_str_holder(argv[2]), _str_holder(argv[3]), seconds(lexical_cast<u32>(_str_holder(argv[4]))),
+                features == "book", format == "csv");
+        }
+        else if(argc == 3 && _str_holder(argv[1]) == "join")
+            join(_str_holder(argv[2]));
+        else if(argc == 3 && _str_holder(argv[1]) == "json_scan")
+            json_scan(_str_holder(argv[2]));
         else
             throw str_exception("unsupported params");
     }
@@ -906,14 +906,14 @@ struct mirror::impl
                     c.set_instrument(m.mi);
                 else if(m.id == msg_trade)
                 {
-                    ttime_t ct = cur_ttime();
+                    ttime_t ct = cur_ttime(m.mt.time);
                     dE = ct - m.mt.etime;
                     dP = ct - m.mt.time;
                     dEdP_printed = false;
                 }
                 else if(m.id == msg_book)
                 {
-                    dP = cur_ttime() - m.mb.time;
+                    dP = cur_ttime(m.mb.time) - m.mb.time;
                     dEdP_printed = false;
                 }
             }